@@ -0,0 +1,787 @@
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "island.h"
+#include "pso.h"
+
+#ifdef BENCH_SIRB
+#include "sirb.h"
+#endif
+
+/*
+   This program benchmarks the PSO library end to end on the standard test
+   functions (and, when compiled with -DBENCH_SIRB, the SIRB model on
+   *nord.dat*). Each case is run with 1, 2, 4, ... threads up to a maximum, and
+   for each run it reports the throughput, the wall time until the best fitness
+   first reached the case's target and the speedup over the single-threaded run
+   of the same driver. Since the synchronous driver gives the same results for
+   any number of threads, its speedups compare identical amounts of work.
+   Results are written to standard output as CSV or JSON. With -DBENCH_SIRB,
+   the option -o compares the throughput and accuracy of the SIRB solvers
+   instead.
+*/
+
+#define BENCH_MAX_DIM 30
+
+#define BENCH_SEED "bench"
+
+typedef struct
+{
+    char *name;
+
+    PSO_FITNESS_T fitness;
+
+    double lower;
+
+    double upper;
+
+    double target;
+} BENCH_FUNCTION_T;
+
+typedef struct
+{
+    PSO_SWARM_T *swarm;
+    size_t begin;
+    size_t end;
+} JOB_T;
+
+typedef enum
+{
+    BENCH_POOL,
+    BENCH_ASYNC,
+    BENCH_SPAWN,
+    BENCH_ISLANDS,
+    BENCH_DRIVERS
+} BENCH_DRIVER_T;
+
+static char *driver_names[] = { "pool", "async", "spawn", "islands" };
+
+// The test functions have no way to learn the dimension, so it is global.
+static size_t dim;
+
+/*
+   The sums of the Sphere, Rosenbrock and Rastrigin functions only grow, so
+   they give up once the partial sum reaches the bound. The Ackley and Griewank
+   functions can't tell before the end, and ignore it.
+*/
+
+static double sphere(double *pos, double bound)
+{
+    double sum = 0;
+
+    for (size_t i = 0; i < dim && sum < bound; ++i)
+        sum += pos[i] * pos[i];
+
+    return sum;
+}
+
+static double rosenbrock(double *pos, double bound)
+{
+    double sum = 0;
+
+    for (size_t i = 0; i + 1 < dim && sum < bound; ++i)
+    {
+        double a = pos[i + 1] - pos[i] * pos[i];
+        double b = 1 - pos[i];
+
+        sum += 100 * a * a + b * b;
+    }
+
+    return sum;
+}
+
+static double rastrigin(double *pos, double bound)
+{
+    double sum = 0;
+
+    // Each term is at least 0.
+    for (size_t i = 0; i < dim && sum < bound; ++i)
+        sum += pos[i] * pos[i] - 10 * cos(2 * M_PI * pos[i]) + 10;
+
+    return sum;
+}
+
+static double ackley(double *pos, double bound)
+{
+    (void)bound;
+
+    double squares = 0;
+    double cosines = 0;
+
+    for (size_t i = 0; i < dim; ++i)
+    {
+        squares += pos[i] * pos[i];
+        cosines += cos(2 * M_PI * pos[i]);
+    }
+
+    return -20 * exp(-0.2 * sqrt(squares / dim)) - exp(cosines / dim) +
+        20 + M_E;
+}
+
+static double griewank(double *pos, double bound)
+{
+    (void)bound;
+
+    double sum = 0;
+    double product = 1;
+
+    for (size_t i = 0; i < dim; ++i)
+    {
+        sum += pos[i] * pos[i];
+        product *= cos(pos[i] / sqrt(i + 1));
+    }
+
+    return 1 + sum / 4000 - product;
+}
+
+static BENCH_FUNCTION_T functions[] =
+{
+    { "sphere", sphere, -100, 100, 1e-6 },
+    { "rosenbrock", rosenbrock, -30, 30, 100 },
+    { "rastrigin", rastrigin, -5.12, 5.12, 100 },
+    { "ackley", ackley, -32, 32, 1 },
+    { "griewank", griewank, -600, 600, 0.1 }
+};
+
+/*
+   The fitness of the model is a mean absolute deviation from real data, which
+   never reaches 0. Runs of the default budget on *nord.dat* end between about
+   29 and 50, so the target sits in that range.
+*/
+
+#define BENCH_SIRB_TARGET 40
+
+static size_t dims[] = { 2, 10, BENCH_MAX_DIM };
+
+static size_t sizes[] = { 20, 40, 100 };
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// The callback tracks progress towards the target of the current run.
+
+static size_t iterations;
+
+static double start;
+
+static double target;
+
+static double time_to_target;
+
+static void track(PSO_SWARM_T *swarm)
+{
+    ++iterations;
+
+    if (time_to_target < 0 && swarm->best_fitness <= target)
+        time_to_target = now() - start;
+}
+
+/*
+   This is the driver the library used to replace: a thread is created and
+   joined for each interval on every iteration. It is kept as a baseline for
+   the overhead of the persistent pool.
+*/
+
+static void *task(void *data)
+{
+    JOB_T *job = (JOB_T *)data;
+
+    pso_evaluate_interval(job->swarm, job->begin, job->end);
+
+    return NULL;
+}
+
+static bool run_spawn(PSO_SWARM_T *swarm, size_t nthreads)
+{
+    if (nthreads > swarm->size)
+        nthreads = swarm->size;
+
+    JOB_T jobs[nthreads];
+
+    pthread_t threads[nthreads];
+
+    size_t per_thread = swarm->size / nthreads;
+
+    for (size_t i = 0; i < nthreads; ++i)
+    {
+        jobs[i].swarm = swarm;
+        jobs[i].begin = i * per_thread;
+        jobs[i].end = (i == nthreads - 1) ? swarm->size - 1 :
+            (i + 1) * per_thread - 1;
+    }
+
+    do
+    {
+        track(swarm);
+
+        pso_shuffle(swarm);
+
+        for (size_t i = 0; i < nthreads; ++i)
+            if (pthread_create(threads + i, NULL, task, jobs + i) != 0)
+                return false;
+
+        for (size_t i = 0; i < nthreads; ++i)
+            pthread_join(threads[i], NULL);
+    } while (pso_finalize(swarm));
+
+    return true;
+}
+
+typedef struct
+{
+    double seconds;
+
+    size_t evals;
+
+    double best;
+} BENCH_RESULT_T;
+
+/*
+   With the island model, each thread runs an island of *size* particles, and
+   the budget is split between the islands. The callback only sees island 0, so
+   the time to target is that of island 0.
+*/
+
+static bool run_islands(
+        BENCH_FUNCTION_T *function,
+        double *lower,
+        double *upper,
+        size_t size,
+        size_t max_evals,
+        size_t nthreads,
+        BENCH_RESULT_T *result
+        )
+{
+    ISLAND_T islands;
+
+    PSO_RESULTS_T results;
+
+    if (!island_initialize(
+                &islands,
+                function->fitness,
+                1.193,
+                0.721,
+                lower,
+                upper,
+                dim,
+                size,
+                max_evals,
+                3,
+                nthreads,
+                10,
+                2,
+                ISLAND_RING,
+                BENCH_SEED
+                ))
+        return false;
+
+    bool success = island_run(&islands, NULL, track);
+
+    result->seconds = now() - start;
+
+    // Every island performs the same number of iterations.
+    result->evals = nthreads * size * (iterations + 1);
+
+    island_write_optimum(&islands, &results);
+
+    result->best = results.fitness;
+
+    if (time_to_target < 0 && results.fitness <= target)
+        time_to_target = result->seconds;
+
+    island_free(&islands);
+
+    return success;
+}
+
+static bool run(
+        BENCH_FUNCTION_T *function,
+        double *lower,
+        double *upper,
+        size_t size,
+        size_t max_evals,
+        BENCH_DRIVER_T driver,
+        size_t nthreads,
+        BENCH_RESULT_T *result
+        )
+{
+    PSO_SWARM_T swarm;
+
+    iterations = 0;
+    target = function->target;
+    time_to_target = -1;
+    start = now();
+
+    if (driver == BENCH_ISLANDS)
+        return run_islands(
+                function,
+                lower,
+                upper,
+                size,
+                max_evals,
+                nthreads,
+                result
+                );
+
+    if (!pso_initialize(
+                &swarm,
+                function->fitness,
+                1.193,
+                0.721,
+                lower,
+                upper,
+                dim,
+                size,
+                max_evals,
+                3,
+                BENCH_SEED
+                ))
+        return false;
+
+    bool success;
+
+    switch (driver)
+    {
+        case BENCH_ASYNC:
+            success = pso_run_async(&swarm, nthreads, NULL, track);
+            break;
+        case BENCH_SPAWN:
+            success = run_spawn(&swarm, nthreads);
+            break;
+        default:
+            success = pso_run_parallel(&swarm, nthreads, NULL, track);
+            break;
+    }
+
+    result->seconds = now() - start;
+
+    // The initial evaluations are included.
+    if (driver == BENCH_ASYNC)
+        result->evals = size + max_evals;
+    else
+        result->evals = size * (iterations + 1);
+
+    result->best = swarm.best_fitness;
+
+    if (time_to_target < 0 && swarm.best_fitness <= target)
+        time_to_target = result->seconds;
+
+    pso_free(&swarm);
+
+    return success;
+}
+
+static bool json = false;
+
+static bool first_record = true;
+
+static void report(
+        char *name,
+        size_t size,
+        BENCH_DRIVER_T driver,
+        size_t nthreads,
+        BENCH_RESULT_T *result,
+        double speedup
+        )
+{
+    char reached[32] = "";
+
+    if (time_to_target >= 0)
+        snprintf(reached, sizeof(reached), "%.6f", time_to_target);
+
+    if (json)
+    {
+        printf(
+                "%s\n  {\"function\": \"%s\", \"dim\": %zu, \"size\": %zu, "
+                "\"driver\": \"%s\", \"threads\": %zu, \"evals\": %zu, "
+                "\"seconds\": %.6f, \"evals_per_second\": %.1f, "
+                "\"target\": %g, \"time_to_target\": %s, "
+                "\"best_fitness\": %.10g, \"speedup\": %.3f}",
+                first_record ? "" : ",",
+                name,
+                dim,
+                size,
+                driver_names[driver],
+                nthreads,
+                result->evals,
+                result->seconds,
+                result->evals / result->seconds,
+                target,
+                (time_to_target >= 0) ? reached : "null",
+                result->best,
+                speedup
+              );
+    }
+    else
+    {
+        printf(
+                "%s,%zu,%zu,%s,%zu,%zu,%.6f,%.1f,%g,%s,%.10g,%.3f\n",
+                name,
+                dim,
+                size,
+                driver_names[driver],
+                nthreads,
+                result->evals,
+                result->seconds,
+                result->evals / result->seconds,
+                target,
+                reached,
+                result->best,
+                speedup
+              );
+    }
+
+    first_record = false;
+}
+
+static bool bench_case(
+        BENCH_FUNCTION_T *function,
+        double *lower,
+        double *upper,
+        size_t size,
+        size_t max_evals,
+        BENCH_DRIVER_T driver,
+        size_t max_threads
+        )
+{
+    double base = 0;
+
+    for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2)
+    {
+        BENCH_RESULT_T result;
+
+        if (!run(
+                    function,
+                    lower,
+                    upper,
+                    size,
+                    max_evals,
+                    driver,
+                    nthreads,
+                    &result
+                    ))
+            return false;
+
+        if (nthreads == 1)
+            base = result.seconds;
+
+        report(
+                function->name,
+                size,
+                driver,
+                nthreads,
+                &result,
+                base / result.seconds
+              );
+    }
+
+    return true;
+}
+
+#ifdef BENCH_SIRB
+/*
+   With -o, the SIRB solvers are compared instead of the drivers: each one
+   integrates the same BENCH_SOLVES parameter sets, which are spread over the
+   search space by an additive recurrence (the fractional parts of multiples
+   of the square roots of the first primes), and for each the throughput and
+   the largest relative deviation of the fitness values from those of the
+   first solver (the GSL reference, unless EXCLUDE_GSL is defined) are
+   reported.
+*/
+
+#define BENCH_SOLVES 2000
+
+typedef struct
+{
+    char *name;
+
+    PSO_FITNESS_T fitness;
+
+    PSO_BATCH_FITNESS_T batch_fitness;
+} BENCH_SOLVER_T;
+
+static BENCH_SOLVER_T solvers[] =
+{
+#ifndef EXCLUDE_GSL
+    { "gsl", sirb_fitness_gsl, NULL },
+#endif
+    { "dopri", sirb_fitness, NULL },
+    { "batch", NULL, sirb_batch_fitness }
+};
+
+static bool compare_solvers(void)
+{
+    static const double primes[SIRB_DIM] = { 2, 3, 5, 7, 11, 13, 17, 19 };
+
+    double *positions = malloc(BENCH_SOLVES * SIRB_DIM * sizeof(double));
+
+    if (!positions)
+        goto compare_solvers_error_1;
+
+    double *reference = malloc(2 * BENCH_SOLVES * sizeof(double));
+
+    if (!reference)
+        goto compare_solvers_error_2;
+
+    double *fitness = reference + BENCH_SOLVES;
+
+    for (size_t i = 0; i < BENCH_SOLVES; ++i)
+        for (size_t d = 0; d < SIRB_DIM; ++d)
+        {
+            double u = fmod((i + 1) * sqrt(primes[d]), 1);
+
+            positions[i * SIRB_DIM + d] = sirb_lower[d] +
+                u * (sirb_upper[d] - sirb_lower[d]);
+        }
+
+    if (json)
+        fputs("[", stdout);
+    else
+        puts("solver,solves,seconds,solves_per_second,max_deviation");
+
+    for (size_t s = 0; s < sizeof(solvers) / sizeof(*solvers); ++s)
+    {
+        BENCH_SOLVER_T *solver = solvers + s;
+
+        double begin = now();
+
+        if (solver->batch_fitness)
+            solver->batch_fitness(
+                    positions,
+                    NULL,
+                    BENCH_SOLVES,
+                    SIRB_DIM,
+                    fitness,
+                    NULL
+                    );
+        else
+            for (size_t i = 0; i < BENCH_SOLVES; ++i)
+                fitness[i] = solver->fitness(
+                        positions + i * SIRB_DIM,
+                        INFINITY
+                        );
+
+        double seconds = now() - begin;
+
+        if (s == 0)
+            memcpy(reference, fitness, BENCH_SOLVES * sizeof(double));
+
+        double deviation = 0;
+
+        for (size_t i = 0; i < BENCH_SOLVES; ++i)
+        {
+            double d = fabs(fitness[i] - reference[i]) / fabs(reference[i]);
+
+            deviation = (d > deviation) ? d : deviation;
+        }
+
+        if (json)
+            printf(
+                    "%s\n  {\"solver\": \"%s\", \"solves\": %d, "
+                    "\"seconds\": %.6f, \"solves_per_second\": %.1f, "
+                    "\"max_deviation\": %.3g}",
+                    s ? "," : "",
+                    solver->name,
+                    BENCH_SOLVES,
+                    seconds,
+                    BENCH_SOLVES / seconds,
+                    deviation
+                  );
+        else
+            printf(
+                    "%s,%d,%.6f,%.1f,%.3g\n",
+                    solver->name,
+                    BENCH_SOLVES,
+                    seconds,
+                    BENCH_SOLVES / seconds,
+                    deviation
+                  );
+    }
+
+    if (json)
+        puts("\n]");
+
+    free(reference);
+    free(positions);
+
+    return true;
+
+compare_solvers_error_2:
+    free(positions);
+compare_solvers_error_1:
+    return false;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    size_t max_threads = 1;
+
+    size_t evals_per_dim = 2000;
+
+    bool drivers[BENCH_DRIVERS] = { true };
+
+    bool model = false;
+
+    bool compare = false;
+
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:e:f:asimo")) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                max_threads = strtoul(optarg, NULL, 10);
+                break;
+            case 'e':
+                evals_per_dim = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                if (strcmp(optarg, "json") == 0)
+                    json = true;
+                else if (strcmp(optarg, "csv") != 0)
+                    goto usage;
+                break;
+            case 'a':
+                drivers[BENCH_ASYNC] = true;
+                break;
+            case 's':
+                drivers[BENCH_SPAWN] = true;
+                break;
+            case 'i':
+                drivers[BENCH_ISLANDS] = true;
+                break;
+            case 'm':
+                model = true;
+                break;
+            case 'o':
+                compare = true;
+                break;
+            default:
+                goto usage;
+        }
+    }
+
+    if (optind != argc || max_threads == 0 || evals_per_dim == 0)
+        goto usage;
+
+#ifndef BENCH_SIRB
+    if (model || compare)
+    {
+        fputs("Compile with -DBENCH_SIRB to benchmark the model.\n", stderr);
+
+        return EXIT_FAILURE;
+    }
+#else
+    if (compare)
+    {
+        if (!compare_solvers())
+            goto error;
+
+        return EXIT_SUCCESS;
+    }
+#endif
+
+    if (json)
+        fputs("[", stdout);
+    else
+        puts(
+                "function,dim,size,driver,threads,evals,seconds,"
+                "evals_per_second,target,time_to_target,best_fitness,speedup"
+            );
+
+    double lower[BENCH_MAX_DIM];
+    double upper[BENCH_MAX_DIM];
+
+    for (size_t f = 0; f < sizeof(functions) / sizeof(*functions); ++f)
+    {
+        BENCH_FUNCTION_T *function = functions + f;
+
+        for (size_t i = 0; i < BENCH_MAX_DIM; ++i)
+        {
+            lower[i] = function->lower;
+            upper[i] = function->upper;
+        }
+
+        for (size_t d = 0; d < sizeof(dims) / sizeof(*dims); ++d)
+        {
+            dim = dims[d];
+
+            for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); ++s)
+                for (unsigned driver = 0; driver < BENCH_DRIVERS; ++driver)
+                    if (drivers[driver] && !bench_case(
+                                function,
+                                lower,
+                                upper,
+                                sizes[s],
+                                evals_per_dim * dim,
+                                driver,
+                                max_threads
+                                ))
+                        goto error;
+        }
+    }
+
+#ifdef BENCH_SIRB
+    if (model)
+    {
+        BENCH_FUNCTION_T function =
+        {
+            "sirb",
+            sirb_fitness,
+            0,
+            0,
+            BENCH_SIRB_TARGET
+        };
+
+        dim = SIRB_DIM;
+
+        for (unsigned driver = 0; driver < BENCH_DRIVERS; ++driver)
+            if (drivers[driver] && !bench_case(
+                        &function,
+                        sirb_lower,
+                        sirb_upper,
+                        40,
+                        evals_per_dim * dim,
+                        driver,
+                        max_threads
+                        ))
+                goto error;
+    }
+#endif
+
+    if (json)
+        puts("\n]");
+
+    return EXIT_SUCCESS;
+
+error:
+    fputs("Benchmark run failed!\n", stderr);
+
+    return EXIT_FAILURE;
+
+usage:
+    fprintf(
+            stderr,
+            "Usage: %s [-t max threads] [-e evals per dimension] "
+            "[-f csv|json] [-a] [-s] [-i] [-m] [-o]\n",
+            argv[0]
+           );
+
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,220 @@
+#include <math.h>
+#include <string.h>
+
+#include "cache.h"
+
+bool cache_initialize(CACHE_T *cache, size_t capacity, size_t dim, double step)
+{
+    if (!(cache && capacity && dim && step > 0))
+        return false;
+
+    // Round the capacity up to a power of two so that probing can mask.
+    size_t rounded = 1;
+
+    while (rounded < capacity)
+        rounded <<= 1;
+
+    cache->entries = calloc(rounded, sizeof(CACHE_ENTRY_T));
+
+    if (!cache->entries)
+        return false;
+
+    cache->keys = malloc(rounded * dim * sizeof(int64_t));
+
+    if (!cache->keys)
+    {
+        free(cache->entries);
+
+        return false;
+    }
+
+    cache->capacity = rounded;
+    cache->dim = dim;
+    cache->step = step;
+    cache->hits = 0;
+    cache->misses = 0;
+
+    return true;
+}
+
+uint64_t cache_key(CACHE_T *cache, double *pos, int64_t *key)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15;
+
+    for (size_t i = 0; i < cache->dim; ++i)
+    {
+        key[i] = (int64_t)floor(pos[i] / cache->step);
+
+        // Mix in each coordinate with the SplitMix64 finalizer.
+        uint64_t z = hash ^ (uint64_t)key[i];
+
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+
+        hash = z ^ (z >> 31);
+    }
+
+    return hash;
+}
+
+/*
+   This copies an entry out of the table, returning false if it is empty, being
+   written or was modified while it was being read.
+*/
+
+static bool read_entry(
+        CACHE_T *cache,
+        size_t slot,
+        CACHE_ENTRY_T *entry,
+        int64_t *key
+        )
+{
+    CACHE_ENTRY_T *src = cache->entries + slot;
+
+    uint64_t seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == 0 || seq & 1)
+        return false;
+
+    entry->hash = __atomic_load_n(&src->hash, __ATOMIC_RELAXED);
+
+    __atomic_load(&src->value, &entry->value, __ATOMIC_RELAXED);
+    __atomic_load(&src->bound, &entry->bound, __ATOMIC_RELAXED);
+
+    int64_t *src_key = cache->keys + slot * cache->dim;
+
+    for (size_t i = 0; i < cache->dim; ++i)
+        key[i] = __atomic_load_n(src_key + i, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    entry->seq = seq;
+
+    return __atomic_load_n(&src->seq, __ATOMIC_RELAXED) == seq;
+}
+
+bool cache_lookup(
+        CACHE_T *cache,
+        int64_t *key,
+        uint64_t hash,
+        double bound,
+        double *value
+        )
+{
+    int64_t found_key[cache->dim];
+
+    for (size_t i = 0; i < CACHE_MAX_PROBES; ++i)
+    {
+        size_t slot = (hash + i) & (cache->capacity - 1);
+
+        CACHE_ENTRY_T entry;
+
+        if (!read_entry(cache, slot, &entry, found_key))
+        {
+            if (__atomic_load_n(
+                        &cache->entries[slot].seq,
+                        __ATOMIC_RELAXED
+                        ) == 0)
+                break;
+
+            continue;
+        }
+
+        if (entry.hash != hash)
+            continue;
+
+        if (memcmp(found_key, key, cache->dim * sizeof(int64_t)) != 0)
+            continue;
+
+        if (entry.value < entry.bound || entry.bound >= bound)
+        {
+            __atomic_fetch_add(&cache->hits, 1, __ATOMIC_RELAXED);
+
+            *value = entry.value;
+
+            return true;
+        }
+
+        break;
+    }
+
+    __atomic_fetch_add(&cache->misses, 1, __ATOMIC_RELAXED);
+
+    return false;
+}
+
+void cache_insert(
+        CACHE_T *cache,
+        int64_t *key,
+        uint64_t hash,
+        double bound,
+        double value
+        )
+{
+    int64_t found_key[cache->dim];
+
+    for (size_t i = 0; i < CACHE_MAX_PROBES; ++i)
+    {
+        size_t slot = (hash + i) & (cache->capacity - 1);
+
+        CACHE_ENTRY_T *dst = cache->entries + slot;
+
+        uint64_t seq = __atomic_load_n(&dst->seq, __ATOMIC_ACQUIRE);
+
+        // Somebody else is writing here, so move on.
+        if (seq & 1)
+            continue;
+
+        if (seq != 0)
+        {
+            CACHE_ENTRY_T entry;
+
+            if (!read_entry(cache, slot, &entry, found_key))
+                continue;
+
+            if (
+                    entry.hash != hash ||
+                    memcmp(found_key, key, cache->dim * sizeof(int64_t)) != 0
+               )
+                continue;
+
+            // Exact values are never replaced.
+            if (entry.value < entry.bound)
+                return;
+
+            seq = entry.seq;
+        }
+
+        // Claim the slot by making its sequence number odd.
+        if (!__atomic_compare_exchange_n(
+                    &dst->seq,
+                    &seq,
+                    seq + 1,
+                    false,
+                    __ATOMIC_ACQUIRE,
+                    __ATOMIC_RELAXED
+                    ))
+            return;
+
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        __atomic_store_n(&dst->hash, hash, __ATOMIC_RELAXED);
+        __atomic_store(&dst->value, &value, __ATOMIC_RELAXED);
+        __atomic_store(&dst->bound, &bound, __ATOMIC_RELAXED);
+
+        int64_t *dst_key = cache->keys + slot * cache->dim;
+
+        for (size_t j = 0; j < cache->dim; ++j)
+            __atomic_store_n(dst_key + j, key[j], __ATOMIC_RELAXED);
+
+        __atomic_store_n(&dst->seq, seq + 2, __ATOMIC_RELEASE);
+
+        return;
+    }
+}
+
+void cache_free(CACHE_T *cache)
+{
+    free(cache->entries);
+    free(cache->keys);
+}
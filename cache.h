@@ -0,0 +1,105 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+/*
+   This file provides definitions for a bounded, concurrent memoization cache
+   of fitness values. Positions in the unit hypercube are quantized onto a grid
+   with a configurable step, and all positions in a grid cell share one entry.
+   The table uses open addressing with linear probing and never grows; once a
+   probe sequence is full, new cells simply aren't stored. No locks are taken:
+   every entry carries a sequence number which is odd while the entry is being
+   written, so readers can detect (and skip) torn entries.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+   This constant defines the maximum number of slots examined by a lookup or an
+   insertion before giving up.
+*/
+
+#ifndef CACHE_MAX_PROBES
+#define CACHE_MAX_PROBES 16
+#endif
+
+typedef struct
+{
+    uint64_t seq;
+
+    uint64_t hash;
+
+    double value;
+
+    double bound;
+} CACHE_ENTRY_T;
+
+typedef struct
+{
+    CACHE_ENTRY_T *entries;
+
+    int64_t *keys;
+
+    size_t capacity;
+
+    size_t dim;
+
+    double step;
+
+    uint64_t hits;
+
+    uint64_t misses;
+} CACHE_T;
+
+/*
+   This function initializes a cache for *dim*-dimensional positions with room
+   for at least *capacity* cells of side length *step*. It returns false on
+   invalid parameters or a memory allocation error.
+*/
+
+bool cache_initialize(CACHE_T *cache, size_t capacity, size_t dim, double step);
+
+/*
+   This function writes the grid cell containing *pos* to *key*, which should
+   have room for the cache's dimension, and returns its hash.
+*/
+
+uint64_t cache_key(CACHE_T *cache, double *pos, int64_t *key);
+
+/*
+   This function looks for the cell *key* with the given *hash*. A value is
+   only usable if it is known to be exact or known to be no lower than
+   *bound*. This mirrors the early abort contract of the fitness function: a
+   value stored together with the bound it was computed under is exact if it
+   is lower than that bound, and otherwise only says that the true fitness is
+   not lower than the bound. It returns true and writes the value to *value* on
+   a hit, and updates the hit and miss counters either way.
+*/
+
+bool cache_lookup(
+        CACHE_T *cache,
+        int64_t *key,
+        uint64_t hash,
+        double bound,
+        double *value
+        );
+
+/*
+   This function stores *value*, computed under *bound*, for the cell *key*. An
+   existing entry for the cell is overwritten unless it is already exact.
+*/
+
+void cache_insert(
+        CACHE_T *cache,
+        int64_t *key,
+        uint64_t hash,
+        double bound,
+        double value
+        );
+
+// This function frees the memory held by the cache (but not *cache* itself).
+
+void cache_free(CACHE_T *cache);
+
+#endif
@@ -0,0 +1,470 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "island.h"
+
+bool island_initialize(
+        ISLAND_T *islands,
+        PSO_FITNESS_T fitness,
+        double c,
+        double omega,
+        double *lower,
+        double *upper,
+        size_t dim,
+        size_t size,
+        size_t max_evals,
+        size_t k,
+        size_t n,
+        size_t interval,
+        size_t migrants,
+        ISLAND_TOPOLOGY_T topology,
+        char *phrase
+        )
+{
+    // Zero values check.
+    if (!(islands && n && interval && migrants && max_evals / n))
+        goto island_initialize_error_1;
+
+    if (migrants > size)
+        goto island_initialize_error_1;
+
+    islands->swarms = malloc(n * sizeof(PSO_SWARM_T));
+
+    if (!islands->swarms)
+        goto island_initialize_error_1;
+
+    if (posix_memalign(
+                (void **)&islands->mailboxes,
+                PSO_ALIGNMENT,
+                n * sizeof(ISLAND_MAILBOX_T)
+                ) != 0)
+        goto island_initialize_error_2;
+
+    size_t len = migrants * (dim + 1);
+
+    islands->buffers = malloc(n * len * sizeof(double));
+
+    if (!islands->buffers)
+        goto island_initialize_error_3;
+
+    // Room for the phrase, a colon and the island number.
+    char *island_phrase = phrase ? malloc(strlen(phrase) + 32) : NULL;
+
+    if (phrase && !island_phrase)
+        goto island_initialize_error_4;
+
+    size_t initialized = 0;
+
+    for (; initialized < n; ++initialized)
+    {
+        if (phrase)
+            sprintf(island_phrase, "%s:%zu", phrase, initialized);
+
+        if (!pso_initialize(
+                    islands->swarms + initialized,
+                    fitness,
+                    c,
+                    omega,
+                    lower,
+                    upper,
+                    dim,
+                    size,
+                    max_evals / n,
+                    k,
+                    island_phrase
+                    ))
+            goto island_initialize_error_5;
+
+        islands->mailboxes[initialized].seq = 0;
+        islands->mailboxes[initialized].data =
+            islands->buffers + initialized * len;
+    }
+
+    free(island_phrase);
+
+    islands->n = n;
+    islands->interval = interval;
+    islands->migrants = migrants;
+    islands->topology = topology;
+
+    return true;
+
+island_initialize_error_5:
+    for (size_t i = 0; i < initialized; ++i)
+        pso_free(islands->swarms + i);
+
+    free(island_phrase);
+island_initialize_error_4:
+    free(islands->buffers);
+island_initialize_error_3:
+    free(islands->mailboxes);
+island_initialize_error_2:
+    free(islands->swarms);
+island_initialize_error_1:
+    return false;
+}
+
+// Particles are ranked by personal best fitness, with ties broken by index.
+static bool before(double *q, size_t a, size_t b)
+{
+    return q[a] < q[b] || (q[a] == q[b] && a < b);
+}
+
+// This writes the indices of the *count* best particles to *best*, best first.
+static void select_best(PSO_SWARM_T *swarm, size_t count, size_t *best)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t choice = swarm->size;
+
+        for (size_t j = 0; j < swarm->size; ++j)
+        {
+            if (i > 0 && !before(swarm->q, best[i - 1], j))
+                continue;
+
+            if (choice == swarm->size || before(swarm->q, j, choice))
+                choice = j;
+        }
+
+        best[i] = choice;
+    }
+}
+
+static void emigrate(ISLAND_T *islands, size_t id)
+{
+    PSO_SWARM_T *swarm = islands->swarms + id;
+
+    size_t destination;
+
+    if (islands->topology == ISLAND_RING)
+        destination = (id + 1) % islands->n;
+    else
+    {
+        destination = transform_integer(swarm->state, 0, islands->n - 2);
+
+        if (destination >= id)
+            ++destination;
+    }
+
+    size_t best[islands->migrants];
+
+    select_best(swarm, islands->migrants, best);
+
+    ISLAND_MAILBOX_T *mailbox = islands->mailboxes + destination;
+
+    uint64_t seq = __atomic_load_n(&mailbox->seq, __ATOMIC_ACQUIRE);
+
+    // Another island is writing here, so these migrants are dropped.
+    if (seq & 1 || !__atomic_compare_exchange_n(
+                &mailbox->seq,
+                &seq,
+                seq + 1,
+                false,
+                __ATOMIC_ACQUIRE,
+                __ATOMIC_RELAXED
+                ))
+        return;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (size_t i = 0; i < islands->migrants; ++i)
+    {
+        double *row = mailbox->data + i * (swarm->dim + 1);
+
+        double *p = pso_personal_best(swarm, best[i]);
+
+        __atomic_store(row, swarm->q + best[i], __ATOMIC_RELAXED);
+
+        for (size_t j = 0; j < swarm->dim; ++j)
+            __atomic_store(row + 1 + j, p + j, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&mailbox->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+   This takes in the migrants in the island's mailbox if they haven't been seen
+   yet (*last* is the sequence number of the last message read). Each migrant
+   replaces the worst personal best of the island if it is better and isn't
+   already present, and the next *pso_finalize()* shares it with the
+   neighbourhood as it would any other improvement.
+*/
+
+static void immigrate(ISLAND_T *islands, size_t id, uint64_t *last)
+{
+    PSO_SWARM_T *swarm = islands->swarms + id;
+
+    ISLAND_MAILBOX_T *mailbox = islands->mailboxes + id;
+
+    size_t row = swarm->dim + 1;
+
+    size_t len = islands->migrants * row;
+
+    uint64_t seq = __atomic_load_n(&mailbox->seq, __ATOMIC_ACQUIRE);
+
+    if (seq & 1 || seq == *last)
+        return;
+
+    double data[len];
+
+    for (size_t i = 0; i < len; ++i)
+        __atomic_load(mailbox->data + i, data + i, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    // The message was overwritten while being read, so try again later.
+    if (__atomic_load_n(&mailbox->seq, __ATOMIC_RELAXED) != seq)
+        return;
+
+    *last = seq;
+
+    for (size_t i = 0; i < islands->migrants; ++i)
+    {
+        double fitness = data[i * row];
+
+        size_t worst = 0;
+
+        bool present = false;
+
+        for (size_t j = 0; j < swarm->size; ++j)
+        {
+            present = present || swarm->q[j] == fitness;
+
+            if (swarm->q[j] > swarm->q[worst])
+                worst = j;
+        }
+
+        if (present || !(fitness < swarm->q[worst]))
+            continue;
+
+        memcpy(
+                pso_personal_best(swarm, worst),
+                data + i * row + 1,
+                swarm->dim * sizeof(double)
+              );
+
+        swarm->q[worst] = fitness;
+    }
+}
+
+typedef struct
+{
+    ISLAND_T *islands;
+
+    PSO_CALLBACK_T callback;
+
+    pthread_mutex_t mutex;
+
+    pthread_cond_t cond;
+
+    bool started;
+
+    bool aborted;
+} ISLAND_RUN_T;
+
+typedef struct
+{
+    ISLAND_RUN_T *run;
+
+    size_t id;
+} ISLAND_WORKER_T;
+
+static void *work(void *data)
+{
+    ISLAND_WORKER_T *worker = (ISLAND_WORKER_T *)data;
+
+    ISLAND_RUN_T *run = worker->run;
+
+    ISLAND_T *islands = run->islands;
+
+    // Wait until every thread exists (or one of them failed to start).
+    pthread_mutex_lock(&run->mutex);
+
+    while (!(run->started || run->aborted))
+        pthread_cond_wait(&run->cond, &run->mutex);
+
+    bool aborted = run->aborted;
+
+    pthread_mutex_unlock(&run->mutex);
+
+    if (aborted)
+        return NULL;
+
+    PSO_SWARM_T *swarm = islands->swarms + worker->id;
+
+    uint64_t last = 0;
+
+    size_t iteration = 0;
+
+    bool running;
+
+    do
+    {
+        if (worker->id == 0 && run->callback)
+            run->callback(swarm);
+
+        pso_shuffle(swarm);
+
+        pso_evaluate_interval(swarm, 0, swarm->size - 1);
+
+        running = pso_finalize(swarm);
+
+        if (!running || islands->n == 1)
+            continue;
+
+        if (++iteration % islands->interval == 0)
+        {
+            emigrate(islands, worker->id);
+            immigrate(islands, worker->id, &last);
+        }
+    } while (running);
+
+    return NULL;
+}
+
+bool island_run(ISLAND_T *islands, int *cpus, PSO_CALLBACK_T callback)
+{
+    if (!islands)
+        goto island_run_error_1;
+
+    size_t n = islands->n;
+
+    ISLAND_WORKER_T *workers = malloc(n * sizeof(ISLAND_WORKER_T));
+
+    if (!workers)
+        goto island_run_error_1;
+
+    pthread_t *threads = malloc(n * sizeof(pthread_t));
+
+    if (!threads)
+        goto island_run_error_2;
+
+    ISLAND_RUN_T run =
+    {
+        .islands = islands,
+        .callback = callback,
+        .started = false,
+        .aborted = false
+    };
+
+    pthread_mutex_init(&run.mutex, NULL);
+    pthread_cond_init(&run.cond, NULL);
+
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+
+#ifndef EXCLUDE_LINUX
+    cpu_set_t old_set;
+
+    if (cpus)
+        pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &old_set);
+#else
+    (void)cpus;
+#endif
+
+    // Island 0 runs on the calling thread.
+    size_t created = 1;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        workers[i].run = &run;
+        workers[i].id = i;
+
+#ifndef EXCLUDE_LINUX
+        if (cpus)
+        {
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i], &set);
+
+            if (i == 0)
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            else
+                pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+#endif
+
+        if (i == 0)
+            continue;
+
+        if (pthread_create(threads + i, &attr, work, workers + i) != 0)
+            break;
+
+        ++created;
+    }
+
+    pthread_attr_destroy(&attr);
+
+    pthread_mutex_lock(&run.mutex);
+
+    if (created == n)
+        run.started = true;
+    else
+        run.aborted = true;
+
+    pthread_cond_broadcast(&run.cond);
+    pthread_mutex_unlock(&run.mutex);
+
+    if (run.started)
+        work(workers);
+
+    for (size_t i = 1; i < created; ++i)
+        pthread_join(threads[i], NULL);
+
+#ifndef EXCLUDE_LINUX
+    if (cpus)
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &old_set);
+#endif
+
+    pthread_cond_destroy(&run.cond);
+    pthread_mutex_destroy(&run.mutex);
+
+    free(threads);
+    free(workers);
+
+    return run.started;
+
+island_run_error_2:
+    free(workers);
+island_run_error_1:
+    return false;
+}
+
+// This returns the island holding the best position found by any island.
+static PSO_SWARM_T *best_island(ISLAND_T *islands)
+{
+    PSO_SWARM_T *best = islands->swarms;
+
+    for (size_t i = 1; i < islands->n; ++i)
+        if (islands->swarms[i].best_fitness < best->best_fitness)
+            best = islands->swarms + i;
+
+    return best;
+}
+
+void island_write_optimum(ISLAND_T *islands, PSO_RESULTS_T *results)
+{
+    pso_write_optimum(best_island(islands), results);
+}
+
+void island_write_position(ISLAND_T *islands, double *pos)
+{
+    pso_write_position(best_island(islands), pos);
+}
+
+void island_free(ISLAND_T *islands)
+{
+    for (size_t i = 0; i < islands->n; ++i)
+        pso_free(islands->swarms + i);
+
+    free(islands->buffers);
+    free(islands->mailboxes);
+    free(islands->swarms);
+}
@@ -0,0 +1,118 @@
+#ifndef _ISLAND_H
+#define _ISLAND_H
+
+/*
+   This file provides definitions for the island model, which runs several
+   independent swarms (islands) side by side, each on its own thread with its
+   own RNG streams. Every few iterations, each island sends copies of its best
+   personal bests to another island, where they replace the worst personal
+   bests they improve on. Islands never wait for each other: each one has a
+   mailbox holding the latest migrants sent to it, guarded by a sequence number
+   which is odd while the mailbox is being written, as in the fitness cache. A
+   sender which finds the mailbox busy drops its migrants, and a receiver which
+   finds it busy (or unchanged) tries again at its next migration.
+*/
+
+#include "pso.h"
+
+typedef enum
+{
+    ISLAND_RING,
+    ISLAND_RANDOM
+} ISLAND_TOPOLOGY_T;
+
+/*
+   Each mailbox holds *migrants* rows of *dim* + 1 doubles: the fitness value
+   followed by the position in the unit hypercube. Mailboxes are aligned so that
+   no two of them share a cache line.
+*/
+
+typedef struct
+{
+    uint64_t seq;
+
+    double *data;
+} __attribute__((aligned(PSO_ALIGNMENT))) ISLAND_MAILBOX_T;
+
+typedef struct
+{
+    PSO_SWARM_T *swarms;
+
+    ISLAND_MAILBOX_T *mailboxes;
+
+    double *buffers;
+
+    size_t n;
+
+    size_t interval;
+
+    size_t migrants;
+
+    ISLAND_TOPOLOGY_T topology;
+} ISLAND_T;
+
+/*
+   This function initializes *n* islands of *size* particles each. The
+   arguments shared with *pso_initialize()* have the same meaning, except that
+   the budget of *max_evals* evaluations is split evenly between the islands,
+   and island i is seeded with the phrase followed by ":i" (if the phrase isn't
+   NULL). Every *interval* iterations, each island sends its *migrants* best
+   particles to the next island (with ISLAND_RING) or to another island chosen
+   at random (with ISLAND_RANDOM). It returns false on invalid parameters or a
+   memory allocation error.
+*/
+
+bool island_initialize(
+        ISLAND_T *islands,
+        PSO_FITNESS_T fitness,
+        double c,
+        double omega,
+        double *lower,
+        double *upper,
+        size_t dim,
+        size_t size,
+        size_t max_evals,
+        size_t k,
+        size_t n,
+        size_t interval,
+        size_t migrants,
+        ISLAND_TOPOLOGY_T topology,
+        char *phrase
+        );
+
+/*
+   This function runs every island to completion on a thread of its own (the
+   calling thread runs island 0). If *cpus* is not NULL, it should hold one CPU
+   number per island, and island i will be pinned to CPU *cpus*[i]. If
+   *callback* is not NULL, it is called with island 0 before each of its
+   iterations, which is enough for reporting progress as the islands advance
+   at roughly the same rate. Because of migration, results are not
+   reproducible with more than one island. It returns false if the threads
+   could not be started, in which case the islands are left untouched.
+*/
+
+bool island_run(ISLAND_T *islands, int *cpus, PSO_CALLBACK_T callback);
+
+/*
+   This function writes the best position found by any island and the
+   corresponding fitness function value to the *results* structure (see
+   *pso_write_optimum()*).
+*/
+
+void island_write_optimum(ISLAND_T *islands, PSO_RESULTS_T *results);
+
+/*
+   This function writes the best position found by any island to *pos* (see
+   *pso_write_position()*).
+*/
+
+void island_write_position(ISLAND_T *islands, double *pos);
+
+/*
+   This function frees all the memory held by initialized islands (but not
+   *islands* itself).
+*/
+
+void island_free(ISLAND_T *islands);
+
+#endif
@@ -1,240 +1,393 @@
-#include <math.h>
+#define _GNU_SOURCE
+
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-#include <pthread.h>
-
-#include <gsl/gsl_errno.h>
-#include <gsl/gsl_odeiv2.h>
+#include <unistd.h>
 
+#include "island.h"
+#include "proc.h"
 #include "pso.h"
+#include "sirb.h"
 
-#include "nord.dat"
+static size_t max_evals = 2000000;
 
-#ifndef NT
-#define NT 1
-#endif
+// This is the budget of the swarm passed to the callback.
+static size_t budget;
 
-char *names[] = 
-{
-    "B_0",
-    "h",
-    "beta_B",
-    "beta_I",
-    "eta",
-    "gamma",
-    "delta",
-    "omega"
-};
-
-typedef struct
+static size_t evaluations = 0;
+
+static double fitness(double *pos, double bound)
 {
-    PSO_SWARM_T *swarm;
-    size_t begin;
-    size_t end;
-} JOB_T;
-
-static int sirb(
-        double time,
-        const double *depvars,
-        double *dydt,
-        void *raw_params
+    __atomic_fetch_add(&evaluations, 1, __ATOMIC_RELAXED);
+
+    return sirb_fitness(pos, bound);
+}
+
+/*
+   In batch mode, the evaluations are counted here since the wrapper above
+   runs in the workers (if there are any). Without workers, the batch is
+   integrated in process with the SIMD solver.
+*/
+
+static void batch_fitness(
+        const double *positions,
+        const double *bounds,
+        size_t n,
+        size_t dim,
+        double *out,
+        void *ctx
         )
 {
-    double *params = (double *)raw_params;
-
-    // Give everything names for instructive purposes.
-
-    double S = depvars[0];
-    double I = depvars[1];
-    double R = depvars[2];
-    double B = depvars[3];
-
-    double N = S + I + R;
-    double b = params[0];
-    double d = params[1];
-    double kappa = params[2];
-    double beta_B = params[3];
-    double beta_I = params[4];
-    double eta = params[5];
-    double gamma = params[6];
-    double delta = params[7];
-    double omega = params[8];
-
-    dydt[0] = b*N - d*S - beta_B*(B*S/(kappa + B)) - beta_I*(S*I/N) + omega*R;
-    dydt[1] = -d*I + beta_B*(B*S/(kappa + B)) + beta_I*(S*I/N) - gamma*I;
-    dydt[2] = -d*R + gamma*I - omega*R;
-    dydt[3] = eta*I - delta*B;
-
-    return GSL_SUCCESS;
+    __atomic_fetch_add(&evaluations, n, __ATOMIC_RELAXED);
+
+    if (ctx)
+        proc_batch_fitness(positions, bounds, n, dim, out, ctx);
+    else
+        sirb_batch_fitness(positions, bounds, n, dim, out, NULL);
 }
 
-static bool solve(
-        double *params,
-        double *initial,
-        double *timeline,
-        size_t timeline_len,
-        double *output
-        )
+static double now(void)
 {
-    gsl_odeiv2_system system =
-    {
-        .function = sirb,
-        .jacobian = NULL,
-        .dimension = 4,
-        .params = params
-    };
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// A checkpoint is written every this many iterations if a path was given.
+#define CHECKPOINT_INTERVAL 1000
+
+static char *checkpoint_path = NULL;
+
+static size_t iteration = 0;
 
-    gsl_odeiv2_step *step = gsl_odeiv2_step_alloc(gsl_odeiv2_step_rkf45, 4);
+static void progress(PSO_SWARM_T *swarm)
+{
+    printf(
+            "\rProgress: %.0f%%",
+            100 * (1 - (double)swarm->max_evals / budget)
+          );
+
+    fflush(stdout);
+
+    if (checkpoint_path && ++iteration % CHECKPOINT_INTERVAL == 0)
+        if (!pso_checkpoint(swarm, checkpoint_path))
+            fputs("\nFailed to write checkpoint!\n", stderr);
+}
+
+static void report(PSO_RESULTS_T *results, double start)
+{
+    double elapsed = now() - start;
+
+    size_t evals = __atomic_load_n(&evaluations, __ATOMIC_RELAXED);
+
+    printf("\nFitness: %.2f\n", results->fitness);
 
-    gsl_odeiv2_control *control = gsl_odeiv2_control_y_new(1e-6, 1e-3);
+    for (unsigned i = 0; i < SIRB_DIM; ++i)
+        printf("%s:\t%.6e\n", sirb_names[i], results->pos[i]);
 
-    gsl_odeiv2_evolve *evolve = gsl_odeiv2_evolve_alloc(4);
+    printf(
+            "Evaluations: %zu in %.2f s (%.0f per second)\n",
+            evals,
+            elapsed,
+            evals / elapsed
+          );
 
-    double t = 0;
-    double h = 1e-6;
+    printf("Stopped by: %s\n", pso_stop_name(results->reason));
+}
+
+/*
+   The island model splits the budget between swarms of the usual size, which
+   exchange their two best particles around a ring every 10 iterations.
+*/
+
+static bool run_islands(
+        size_t nislands,
+        int *cpus,
+        char *phrase,
+        PSO_TERMINATION_T *termination,
+        PSO_RESTART_T *restart,
+        TOPOLOGY_KIND_T topology,
+        PSO_RESULTS_T *results
+        )
+{
+    ISLAND_T islands;
+
+    budget = max_evals / nislands;
+
+    if (!island_initialize(
+                &islands,
+                fitness,
+                1.193,
+                0.721,
+                sirb_lower,
+                sirb_upper,
+                SIRB_DIM,
+                40,
+                max_evals,
+                3,
+                nislands,
+                10,
+                2,
+                ISLAND_RING,
+                phrase
+                ))
+    {
+        fputs("Failed to initialize islands!\n", stderr);
 
-    bool success = false;
+        return false;
+    }
 
-    for (size_t i = 0; i < timeline_len; ++i)
+    for (size_t i = 0; i < nislands; ++i)
     {
-        double t1 = timeline[i];
+        pso_set_termination(islands.swarms + i, termination);
+        pso_set_restart(islands.swarms + i, restart);
 
-        while (t < t1)
+        if (
+                topology != TOPOLOGY_ADAPTIVE &&
+                !pso_set_topology(islands.swarms + i, topology)
+           )
         {
-            if (gsl_odeiv2_evolve_apply(
-                    evolve,
-                    control,
-                    step,
-                    &system,
-                    &t,
-                    t1,
-                    &h,
-                    initial
-                    ) != GSL_SUCCESS)
-                goto solve_finish;
+            fputs("Failed to set up topology!\n", stderr);
+
+            return false;
         }
+    }
+
+    if (!island_run(&islands, cpus, progress))
+    {
+        fputs("Thread creation error!\n", stderr);
 
-        memcpy(output + 4 * i, initial, 4 * sizeof(double));
+        return false;
     }
 
-    success = true;
+    island_write_optimum(&islands, results);
 
-solve_finish:
-    gsl_odeiv2_evolve_free(evolve);
-    gsl_odeiv2_control_free(control);
-    gsl_odeiv2_step_free(step);
+    island_free(&islands);
 
-    return success;
+    return true;
 }
 
-static double fitness(double *pos)
+int main(int argc, char **argv)
 {
-    double initial[] = { S_INIT, I_INIT, 0, 0 };
-    double params[9] = { 0.000072, 0.000044, 1e6 };
-    double output[4 * TIMES_LEN];
+    size_t nthreads = 1;
+
+    bool pin = false;
+
+    bool owned = false;
+
+    bool vectorized = false;
+
+    bool async = false;
 
-    initial[1] /= pos[1];
-    initial[3] = pos[0] * 1e6;
+    double step = 0;
 
-    memcpy(params + 3, pos + 2, 6 * sizeof(double));
+    char *stats_path = NULL;
 
-    if (!solve(params, initial, times, TIMES_LEN, output))
+    size_t nislands = 0;
+
+    size_t nworkers = 0;
+
+    // Only the budget applies unless other stopping rules are given.
+    PSO_TERMINATION_T termination = { .has_target = false };
+
+    // Restarts grow the swarm up to 16 times its initial size.
+    PSO_RESTART_T restart = { .growth = 1, .max_size = 16 * 40 };
+
+    TOPOLOGY_KIND_T topology = TOPOLOGY_ADAPTIVE;
+
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:poaq:c:s:i:w:vg:d:r:x:n:")) != -1)
     {
-        fputs("Solver error!\n", stderr);
-        exit(EXIT_FAILURE);
+        switch (opt)
+        {
+            case 'c':
+                checkpoint_path = optarg;
+                break;
+            case 's':
+                stats_path = optarg;
+                break;
+            case 'i':
+                nislands = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                nworkers = strtoul(optarg, NULL, 10);
+                break;
+            case 'v':
+                vectorized = true;
+                break;
+            case 'g':
+                termination.stagnation = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                termination.time_limit = strtod(optarg, NULL);
+                break;
+            case 'r':
+                restart.stagnation = strtoul(optarg, NULL, 10);
+                break;
+            case 'x':
+                restart.growth = strtod(optarg, NULL);
+                break;
+            case 'n':
+                for (topology = 0; topology < TOPOLOGY_KINDS; ++topology)
+                    if (strcmp(optarg, topology_name(topology)) == 0)
+                        break;
+
+                if (topology == TOPOLOGY_KINDS)
+                    goto usage;
+
+                break;
+            case 'q':
+                step = strtod(optarg, NULL);
+                break;
+            case 'a':
+                async = true;
+                break;
+            case 't':
+                nthreads = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                pin = true;
+                break;
+            case 'o':
+                owned = true;
+                break;
+            default:
+                goto usage;
+        }
     }
 
-    double mad = 0;
+    if (optind != argc - 1 || nthreads == 0)
+        goto usage;
 
-    for (size_t i = 0; i < TIMES_LEN; ++i)
-        mad += fabs(output[4 * i + 1] * pos[1] - ivals[i]);
+    // A checkpoint needs a point between iterations, which async mode lacks.
+    if (async && checkpoint_path)
+        goto usage;
 
-    return mad / TIMES_LEN;
-}
+    // Islands come with their own threads and can't be checkpointed.
+    if (nislands && (async || checkpoint_path || step > 0 || stats_path))
+        goto usage;
 
-static void partition(PSO_SWARM_T *swarm, JOB_T *jobs)
-{
-    size_t per_thread = swarm->size / NT;
+    // Worker processes and the SIMD solver are driven through batch mode.
+    bool batch = nworkers || vectorized;
+
+    if (batch && (async || checkpoint_path || step > 0 || nislands))
+        goto usage;
+
+    if (nworkers && vectorized)
+        goto usage;
 
-    size_t remainder = swarm->size % NT;
+    // With islands, each island is a thread of its own.
+    if (nislands)
+        nthreads = nislands;
 
-    for (size_t i = 0; i < remainder; ++i)
+    int *cpus = NULL;
+
+    if (pin)
     {
-        jobs[i].swarm = swarm;
-        jobs[i].begin = i * (per_thread + 1);
-        jobs[i].end = i * (per_thread + 1) + per_thread;
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        cpus = malloc(nthreads * sizeof(int));
+
+        if (!cpus || ncpus < 1)
+        {
+            fputs("Failed to set up CPU pinning!\n", stderr);
+
+            return EXIT_FAILURE;
+        }
+
+        for (size_t i = 0; i < nthreads; ++i)
+            cpus[i] = i % ncpus;
     }
 
-    for (size_t i = remainder; i < NT; ++i)
+    PSO_RESULTS_T results;
+
+    double start = now();
+
+    if (nislands)
     {
-        jobs[i].swarm = swarm;
-        jobs[i].begin = remainder + i * per_thread;
-        jobs[i].end = remainder + (i + 1) * per_thread - 1;
+        if (!run_islands(
+                    nislands,
+                    cpus,
+                    argv[optind],
+                    &termination,
+                    &restart,
+                    topology,
+                    &results
+                    ))
+            return EXIT_FAILURE;
+
+        free(cpus);
+
+        report(&results, start);
+
+        return EXIT_SUCCESS;
     }
-}
 
-void *task(void *data)
-{
-    JOB_T *job = (JOB_T *)data;
+    PSO_SWARM_T swarm;
 
-    pso_evaluate_interval(job->swarm, job->begin, job->end);
+    PROC_POOL_T pool;
 
-    return NULL;
-}
+    budget = max_evals;
 
-int main(int argc, char **argv)
-{
-    if (argc != 2)
+    // The workers are forked before any threads exist.
+    if (nworkers && !proc_initialize(&pool, sirb_fitness, nworkers, 2))
     {
-        fprintf(stderr, "Usage: %s \"Seed phrase\"\n", argv[0]);
+        fputs("Failed to start worker processes!\n", stderr);
 
         return EXIT_FAILURE;
     }
 
-    PSO_SWARM_T swarm;
-    PSO_RESULTS_T results;
+    bool restored = checkpoint_path && access(checkpoint_path, F_OK) == 0;
 
-    double lower[] =
+    // Resume from the checkpoint if there is one.
+    if (restored)
     {
-        0,
-        0.001,
-        0.001,
-        0.001,
-        0.001,
-        1.0 / 14,
-        1.0 / 40,
-        0.0001
-    };
-
-    double upper[] =
+        if (!pso_restore(&swarm, checkpoint_path, fitness))
+        {
+            fputs("Failed to restore checkpoint!\n", stderr);
+
+            return EXIT_FAILURE;
+        }
+    }
+    else if (batch && !pso_initialize_batch(
+                &swarm,
+                batch_fitness,
+                nworkers ? &pool : NULL,
+                1.193,
+                0.721,
+                sirb_lower,
+                sirb_upper,
+                SIRB_DIM,
+                40,
+                max_evals,
+                3,
+                argv[optind]
+                ))
     {
-        1,
-        1,
-        1,
-        0.5,
-        1,
-        1.0 / 2,
-        1.0 / 3,
-        1.0 / 360
-    };
-
-    size_t max_evals = 2000000;
-
-    if (!pso_initialize(
+        fputs("Failed to initialize swarm!\n", stderr);
+
+        return EXIT_FAILURE;
+    }
+    else if (!batch && !pso_initialize(
                 &swarm,
                 fitness,
                 1.193,
                 0.721,
-                lower,
-                upper,
-                8,
+                sirb_lower,
+                sirb_upper,
+                SIRB_DIM,
                 40,
                 max_evals,
                 3,
-                argv[1]
+                argv[optind]
                 ))
     {
         fputs("Failed to initialize swarm!\n", stderr);
@@ -242,47 +395,119 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    JOB_T jobs[NT];
+    if (step > 0 && !pso_enable_cache(&swarm, 1 << 20, step))
+    {
+        fputs("Failed to allocate fitness cache!\n", stderr);
 
-    pthread_t threads[NT];
+        return EXIT_FAILURE;
+    }
 
-    partition(&swarm, jobs);
+    // A restored swarm keeps the topology it was saved with.
+    if (
+            !restored &&
+            topology != TOPOLOGY_ADAPTIVE &&
+            !pso_set_topology(&swarm, topology)
+       )
+    {
+        fputs("Failed to set up topology!\n", stderr);
+
+        return EXIT_FAILURE;
+    }
+
+    // Likewise, a restored swarm keeps its blocks.
+    if (owned && !restored)
+        pso_set_ownership(
+                &swarm,
+                (nthreads < swarm.size) ? nthreads : swarm.size
+                );
+
+    // Unlike the worker pool, the SIMD solver can run on every thread at once.
+    if (vectorized)
+        pso_set_batch_split(&swarm, true);
+
+    // A restored swarm also keeps its stopping and restart rules.
+    if (!restored)
+    {
+        pso_set_termination(&swarm, &termination);
+        pso_set_restart(&swarm, &restart);
+    }
 
-    do
+    bool started = async ?
+        pso_run_async(&swarm, nthreads, cpus, progress) :
+        pso_run_parallel(&swarm, nthreads, cpus, progress);
+
+    if (!started)
     {
+        fputs("Thread creation error!\n", stderr);
+
+        return EXIT_FAILURE;
+    }
+
+    free(cpus);
+
+    pso_write_optimum(&swarm, &results);
+
+    report(&results, start);
+
+    if (swarm.restart.stagnation)
         printf(
-                "\rProgress: %.0f%%",
-                100 * (1 - (double)swarm.max_evals / max_evals)
+                "Restarts: %zu (final swarm size %zu)\n",
+                swarm.restarts,
+                swarm.size
               );
 
-        fflush(stdout);
+    if (step > 0)
+    {
+        uint64_t hits, misses;
 
-        pso_shuffle(&swarm);
+        pso_cache_stats(&swarm, &hits, &misses);
 
-        for (size_t i = 0; i < NT; ++i)
-            if (pthread_create(threads + i, NULL, task, jobs + i) != 0)
-            {
-                fputs("Thread creation error!\n", stderr);
+        printf(
+                "Cache hits: %" PRIu64 " of %" PRIu64 " lookups\n",
+                hits,
+                hits + misses
+              );
+    }
 
-                return EXIT_FAILURE;
-            }
+    if (stats_path)
+    {
+        PSO_STATS_T stats;
 
-        for (size_t i = 0; i < NT; ++i)
-            if (pthread_join(threads[i], NULL) != 0)
-            {
-                fputs("Thread join error!\n", stderr);
+        FILE *file;
 
-                return EXIT_FAILURE;
-            }
+        if (!pso_get_stats(&swarm, &stats))
+            fputs("Statistics require compiling with -DPSO_STATS!\n", stderr);
+        else if (!(file = fopen(stats_path, "w")))
+            fputs("Failed to open statistics file!\n", stderr);
+        else
+        {
+            bool written = pso_write_stats(&stats, file);
 
-    } while (pso_finalize(&swarm));
+            if (fclose(file) != 0 || !written)
+                fputs("Failed to write statistics!\n", stderr);
+        }
+    }
 
-    pso_write_optimum(&swarm, &results);
+    if (nworkers)
+    {
+        printf("Worker restarts: %" PRIu64 "\n", pool.restarts);
 
-    printf("\nFitness: %.2f\n", results.fitness);
+        proc_free(&pool);
+    }
 
-    for (unsigned i = 0; i < 8; ++i)
-        printf("%s:\t%.6e\n", names[i], results.pos[i]);
+    pso_free(&swarm);
 
     return EXIT_SUCCESS;
+
+usage:
+    fprintf(
+            stderr,
+            "Usage: %s [-t threads] [-p] [-o] [-a] [-q step] [-c checkpoint] "
+            "[-s stats] [-i islands] [-w workers] [-v] [-g iterations] "
+            "[-d seconds] [-r iterations] [-x growth] [-n topology] "
+            "\"Seed phrase\"\n",
+            argv[0]
+           );
+
+    return EXIT_FAILURE;
 }
@@ -0,0 +1,352 @@
+/*
+   This file gives an implementation of the Philox4x32-10 counter-based
+   generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+   Every 128-bit counter is encrypted independently under a 64-bit key, giving
+   two blocks, so the state keeps a buffer of PHILOX_BLOCKS blocks which is
+   refilled a whole batch of counters at a time, PHILOX_LANES counters side by
+   side. Jumping only moves the counter, so substreams are split off for free.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rng.h"
+
+// This must be a multiple of 2 * PHILOX_LANES.
+#ifndef PHILOX_BLOCKS
+#define PHILOX_BLOCKS 256
+#endif
+
+#define PHILOX_LANES 16
+
+#define PHILOX_M0 0xd2511f53
+#define PHILOX_M1 0xcd9e8d57
+#define PHILOX_W0 0x9e3779b9
+#define PHILOX_W1 0xbb67ae85
+
+/*
+   The lane loops below are simple enough for the compiler to vectorize, and
+   on x86-64 they are cloned for AVX-512 and AVX2 as in *util.h*.
+*/
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(EXCLUDE_SIMD)
+#define PHILOX_CLONES __attribute__((target_clones( \
+                "arch=skylake-avx512", \
+                "arch=haswell", \
+                "default" \
+                )))
+#else
+#define PHILOX_CLONES
+#endif
+
+/*
+   The buffer holds the outputs of the PHILOX_BLOCKS / 2 counters starting at
+   *base* (as two 64-bit halves, low first), and *pos* is the next block to
+   hand out.
+*/
+
+typedef struct
+{
+    uint64_t blocks[PHILOX_BLOCKS];
+
+    uint64_t base[2];
+
+    uint32_t key[2];
+
+    size_t pos;
+} PHILOX_STATE_T;
+
+char *rng_name(void)
+{
+    return "Philox4x32-10";
+}
+
+char *rng_uid(void)
+{
+    return "9c0e5d1b27a84f6e93d1c8b0a5f4e372";
+}
+
+RNG_STATE_T rng_allocate_state(void)
+{
+    // The size is rounded up to whole cache lines.
+    size_t len = sizeof(PHILOX_STATE_T) + RNG_ALIGNMENT - 1;
+
+    void *state;
+
+    if (posix_memalign(&state, RNG_ALIGNMENT, len - len % RNG_ALIGNMENT) != 0)
+        return NULL;
+
+    return state;
+}
+
+void rng_free_state(RNG_STATE_T state)
+{
+    free(state);
+}
+
+/*
+   This writes the outputs of *n* consecutive counters starting at *base* to
+   *out* (n must be a multiple of PHILOX_LANES). Word i of counter j is kept in
+   *c*[i][j], and each round is applied to all the lanes before the next, so
+   the rounds of different counters overlap instead of waiting on each other's
+   multiplications.
+*/
+
+PHILOX_CLONES static void generate(
+        uint64_t *out,
+        const uint64_t *base,
+        const uint32_t *key,
+        size_t n
+        )
+{
+    uint64_t lo = base[0];
+    uint64_t hi = base[1];
+
+    for (size_t i = 0; i < n; i += PHILOX_LANES)
+    {
+        uint32_t c[4][PHILOX_LANES];
+
+        for (unsigned j = 0; j < PHILOX_LANES; ++j)
+        {
+            uint64_t low = lo + j;
+            uint64_t high = hi + (low < lo);
+
+            c[0][j] = low;
+            c[1][j] = low >> 32;
+            c[2][j] = high;
+            c[3][j] = high >> 32;
+        }
+
+        uint32_t k0 = key[0];
+        uint32_t k1 = key[1];
+
+        for (unsigned r = 0; r < 10; ++r)
+        {
+            for (unsigned j = 0; j < PHILOX_LANES; ++j)
+            {
+                uint64_t p0 = (uint64_t)c[0][j] * PHILOX_M0;
+                uint64_t p1 = (uint64_t)c[2][j] * PHILOX_M1;
+
+                c[0][j] = (uint32_t)(p1 >> 32) ^ c[1][j] ^ k0;
+                c[1][j] = p1;
+                c[2][j] = (uint32_t)(p0 >> 32) ^ c[3][j] ^ k1;
+                c[3][j] = p0;
+            }
+
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+
+        for (unsigned j = 0; j < PHILOX_LANES; ++j)
+        {
+            out[2 * (i + j)] = (uint64_t)c[1][j] << 32 | c[0][j];
+            out[2 * (i + j) + 1] = (uint64_t)c[3][j] << 32 | c[2][j];
+        }
+
+        hi += lo + PHILOX_LANES < lo;
+        lo += PHILOX_LANES;
+    }
+}
+
+// This moves the base past the buffer and refills it.
+static void refill(PHILOX_STATE_T *s)
+{
+    s->base[1] += s->base[0] + PHILOX_BLOCKS / 2 < s->base[0];
+    s->base[0] += PHILOX_BLOCKS / 2;
+
+    generate(s->blocks, s->base, s->key, PHILOX_BLOCKS / 2);
+
+    s->pos = 0;
+}
+
+/*
+   The seed value (as pointed to by *seed*) must be 128 bits. The first half is
+   the key, and the second half is the high half of the initial counter.
+*/
+
+void rng_initialize_state(RNG_STATE_T state, RNG_SEED_T seed)
+{
+    PHILOX_STATE_T *s = (PHILOX_STATE_T *)state;
+
+    uint64_t *words = (uint64_t *)seed;
+
+    s->key[0] = words[0];
+    s->key[1] = words[0] >> 32;
+
+    s->base[0] = 0;
+    s->base[1] = words[1];
+
+    generate(s->blocks, s->base, s->key, PHILOX_BLOCKS / 2);
+
+    s->pos = 0;
+}
+
+void rng_copy_state(RNG_STATE_T dst, RNG_STATE_T src)
+{
+    memcpy(dst, src, sizeof(PHILOX_STATE_T));
+}
+
+/*
+   The high half of the counter is incremented, which skips 2^65 blocks. The
+   buffer is regenerated at the new base, and the position within it is kept.
+*/
+
+void rng_jump(RNG_STATE_T state)
+{
+    PHILOX_STATE_T *s = (PHILOX_STATE_T *)state;
+
+    ++s->base[1];
+
+    generate(s->blocks, s->base, s->key, PHILOX_BLOCKS / 2);
+}
+
+// Only the key, the base and the position are saved.
+size_t rng_state_size(void)
+{
+    return 32;
+}
+
+void rng_save_state(RNG_STATE_T state, void *buf)
+{
+    PHILOX_STATE_T *s = (PHILOX_STATE_T *)state;
+
+    uint64_t pos = s->pos;
+
+    memcpy(buf, s->base, 16);
+    memcpy((char *)buf + 16, s->key, 8);
+    memcpy((char *)buf + 24, &pos, 8);
+}
+
+void rng_load_state(RNG_STATE_T state, const void *buf)
+{
+    PHILOX_STATE_T *s = (PHILOX_STATE_T *)state;
+
+    uint64_t pos;
+
+    memcpy(s->base, buf, 16);
+    memcpy(s->key, (const char *)buf + 16, 8);
+    memcpy(&pos, (const char *)buf + 24, 8);
+
+    generate(s->blocks, s->base, s->key, PHILOX_BLOCKS / 2);
+
+    s->pos = (pos > PHILOX_BLOCKS) ? PHILOX_BLOCKS : pos;
+}
+
+/* 128-bit multiplication emulated with 4 64-bit values, each representing a
+   32-bit value plus carry. The high 128 bits of the product are ignored.
+*/
+
+#define PHILOX_MASK 0x00000000ffffffff;
+
+static void mul128(uint64_t *a, uint64_t *b)
+{
+    uint64_t c[4];
+
+    // Compute word 0 and carry once.
+    c[0] = a[0] * b[0];
+    c[1] = c[0] >> 32;
+    c[0] &= PHILOX_MASK;
+
+    // Compute word 1 and carry twice.
+    c[1] += a[0] * b[1];
+    c[2] = c[1] >> 32;
+    c[1] &= PHILOX_MASK;
+
+    c[1] += a[1] * b[0];
+    c[2] += c[1] >> 32;
+    c[1] &= PHILOX_MASK;
+
+    // Compute word 2 and carry thrice.
+    c[2] += a[0] * b[2];
+    c[3] = c[2] >> 32;
+    c[2] &= PHILOX_MASK;
+
+    c[2] += a[1] * b[1];
+    c[3] += c[2] >> 32;
+    c[2] &= PHILOX_MASK;
+
+    c[2] += a[2] * b[0];
+    c[3] += c[2] >> 32;
+    c[2] &= PHILOX_MASK;
+
+    // Compute word 3 and discard carries.
+    c[3] += a[0] * b[3] + a[1] * b[2] + a[2] * b[1] + a[3] * b[0];
+    c[3] &= PHILOX_MASK;
+
+    // Copy result back to *a*.
+    memcpy(a, c, 32);
+}
+
+// Implements the FNV-1a 128-bit hash, as in the xorshift128+ module.
+void rng_derive_seed(RNG_SEED_T seed, char *phrase)
+{
+    if (!seed || !phrase)
+        return;
+
+    uint64_t hash[] = { 0x6295c58d, 0x62b82175, 0x07bb0142, 0x6c62272e };
+    uint64_t fnv_prime[] = { 0x0000013b, 0, 0x01000000, 0 };
+
+    for (; *phrase; ++phrase)
+    {
+        hash[0] ^= *phrase;
+
+        mul128(hash, fnv_prime);
+    }
+
+    uint64_t *s = (uint64_t *)seed;
+
+    s[0] = hash[1] << 32 | hash[0];
+    s[1] = hash[3] << 32 | hash[2];
+}
+
+uint64_t rng_next_block(RNG_STATE_T state)
+{
+    PHILOX_STATE_T *s = (PHILOX_STATE_T *)state;
+
+    if (s->pos == PHILOX_BLOCKS)
+        refill(s);
+
+    return s->blocks[s->pos++];
+}
+
+/*
+   Whole buffers' worth of blocks are generated straight into *buf*, skipping
+   the copy through the state.
+*/
+
+void rng_fill_blocks(RNG_STATE_T state, uint64_t *buf, size_t n)
+{
+    PHILOX_STATE_T *s = (PHILOX_STATE_T *)state;
+
+    size_t len = PHILOX_BLOCKS - s->pos;
+
+    if (n <= len)
+    {
+        memcpy(buf, s->blocks + s->pos, n * sizeof(uint64_t));
+
+        s->pos += n;
+
+        return;
+    }
+
+    memcpy(buf, s->blocks + s->pos, len * sizeof(uint64_t));
+
+    buf += len;
+    n -= len;
+
+    for (; n >= PHILOX_BLOCKS; buf += PHILOX_BLOCKS, n -= PHILOX_BLOCKS)
+    {
+        s->base[1] += s->base[0] + PHILOX_BLOCKS / 2 < s->base[0];
+        s->base[0] += PHILOX_BLOCKS / 2;
+
+        generate(buf, s->base, s->key, PHILOX_BLOCKS / 2);
+    }
+
+    refill(s);
+
+    memcpy(buf, s->blocks, n * sizeof(uint64_t));
+
+    s->pos = n;
+}
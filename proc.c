@@ -0,0 +1,424 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "proc.h"
+
+// This sends exactly *len* bytes, returning false on an error.
+static bool send_all(int fd, const void *data, size_t len)
+{
+    const char *cursor = (const char *)data;
+
+    while (len)
+    {
+        ssize_t sent = send(fd, cursor, len, MSG_NOSIGNAL);
+
+        if (sent < 0 && errno == EINTR)
+            continue;
+
+        if (sent <= 0)
+            return false;
+
+        cursor += sent;
+        len -= sent;
+    }
+
+    return true;
+}
+
+// This receives up to *len* bytes, returning fewer only on an error or EOF.
+static size_t recv_all(int fd, void *data, size_t len)
+{
+    char *cursor = (char *)data;
+
+    size_t total = 0;
+
+    while (total < len)
+    {
+        ssize_t received = recv(fd, cursor + total, len - total, 0);
+
+        if (received < 0 && errno == EINTR)
+            continue;
+
+        if (received <= 0)
+            break;
+
+        total += received;
+    }
+
+    return total;
+}
+
+bool proc_serve(int fd, PSO_FITNESS_T fitness)
+{
+    double *positions = NULL;
+    double *values = NULL;
+
+    size_t capacity = 0;
+
+    bool ok = false;
+
+    for (;;)
+    {
+        uint64_t header[3];
+
+        size_t received = recv_all(fd, header, sizeof(header));
+
+        // An EOF in place of a request is a clean shutdown.
+        if (received == 0)
+        {
+            ok = true;
+
+            break;
+        }
+
+        if (received != sizeof(header))
+            break;
+
+        size_t n = header[1];
+        size_t dim = header[2];
+
+        if (n * dim > capacity || n > capacity)
+        {
+            capacity = (n * dim > n) ? n * dim : n;
+
+            free(positions);
+            free(values);
+
+            positions = malloc(capacity * sizeof(double));
+            values = malloc(capacity * sizeof(double));
+
+            if (!(positions && values))
+                break;
+        }
+
+        size_t len = n * dim * sizeof(double);
+
+        if (recv_all(fd, positions, len) != len)
+            break;
+
+        for (size_t i = 0; i < n; ++i)
+            values[i] = fitness(positions + i * dim, INFINITY);
+
+        uint64_t reply[2] = { header[0], n };
+
+        if (!send_all(fd, reply, sizeof(reply)))
+            break;
+
+        if (!send_all(fd, values, n * sizeof(double)))
+            break;
+    }
+
+    free(positions);
+    free(values);
+
+    return ok;
+}
+
+/*
+   This forks the worker in slot *index*. The child keeps only its own end of
+   a fresh socket pair, so that the death of any process is seen as an EOF by
+   the other side.
+*/
+
+static bool spawn(PROC_POOL_T *pool, size_t index)
+{
+    PROC_WORKER_T *worker = pool->workers + index;
+
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return false;
+
+    // Buffered output would otherwise be written again by the child.
+    fflush(NULL);
+
+    pid_t pid = fork();
+
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        for (size_t i = 0; i < pool->nworkers; ++i)
+            if (pool->workers[i].fd >= 0)
+                close(pool->workers[i].fd);
+
+        close(fds[0]);
+
+        bool ok = proc_serve(fds[1], pool->fitness);
+
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+
+    worker->pid = pid;
+    worker->fd = fds[0];
+    worker->npending = 0;
+
+    return true;
+}
+
+static void bury(PROC_WORKER_T *worker)
+{
+    close(worker->fd);
+
+    waitpid(worker->pid, NULL, 0);
+
+    worker->fd = -1;
+}
+
+bool proc_initialize(
+        PROC_POOL_T *pool,
+        PSO_FITNESS_T fitness,
+        size_t nworkers,
+        size_t chunk
+        )
+{
+    if (!(pool && fitness && nworkers && chunk))
+        return false;
+
+    pool->workers = malloc(nworkers * sizeof(PROC_WORKER_T));
+
+    if (!pool->workers)
+        return false;
+
+    pool->fitness = fitness;
+    pool->nworkers = nworkers;
+    pool->chunk = chunk;
+    pool->restarts = 0;
+
+    for (size_t i = 0; i < nworkers; ++i)
+        pool->workers[i].fd = -1;
+
+    for (size_t i = 0; i < nworkers; ++i)
+        if (!spawn(pool, i))
+        {
+            proc_free(pool);
+
+            return false;
+        }
+
+    return true;
+}
+
+/*
+   This replaces a dead worker, queueing its outstanding chunks in *retry*. If
+   a new worker can't be forked, the slot is left empty.
+*/
+
+static void replace(
+        PROC_POOL_T *pool,
+        size_t index,
+        uint64_t *retry,
+        size_t *nretry
+        )
+{
+    PROC_WORKER_T *worker = pool->workers + index;
+
+    for (size_t i = 0; i < worker->npending; ++i)
+        retry[(*nretry)++] = worker->pending[i];
+
+    bury(worker);
+
+    if (spawn(pool, index))
+        ++pool->restarts;
+}
+
+// This reads one reply into *out*, returning false if the worker has died.
+static bool receive(
+        PROC_POOL_T *pool,
+        PROC_WORKER_T *worker,
+        size_t n,
+        double *out
+        )
+{
+    uint64_t reply[2];
+
+    if (recv_all(worker->fd, reply, sizeof(reply)) != sizeof(reply))
+        return false;
+
+    // Replies come back in the order the requests were sent.
+    uint64_t id = worker->pending[0];
+
+    size_t begin = id * pool->chunk;
+
+    size_t len = (n - begin < pool->chunk) ? n - begin : pool->chunk;
+
+    if (reply[0] != id || reply[1] != len)
+        return false;
+
+    len *= sizeof(double);
+
+    if (recv_all(worker->fd, out + begin, len) != len)
+        return false;
+
+    --worker->npending;
+
+    memmove(
+            worker->pending,
+            worker->pending + 1,
+            worker->npending * sizeof(uint64_t)
+           );
+
+    return true;
+}
+
+void proc_batch_fitness(
+        const double *positions,
+        const double *bounds,
+        size_t n,
+        size_t dim,
+        double *out,
+        void *ctx
+        )
+{
+    (void)bounds;
+
+    PROC_POOL_T *pool = (PROC_POOL_T *)ctx;
+
+    size_t nchunks = (n + pool->chunk - 1) / pool->chunk;
+
+    unsigned attempts[nchunks];
+
+    bool finished[nchunks];
+
+    // Chunks lost to dead workers are sent again before any new ones.
+    uint64_t retry[nchunks];
+
+    size_t nretry = 0;
+
+    size_t next = 0;
+
+    size_t done = 0;
+
+    memset(attempts, 0, sizeof(attempts));
+    memset(finished, 0, sizeof(finished));
+
+    struct pollfd fds[pool->nworkers];
+
+    while (done < nchunks)
+    {
+        bool busy = false;
+
+        // Keep every worker's pipeline full.
+        for (size_t i = 0; i < pool->nworkers; ++i)
+        {
+            PROC_WORKER_T *worker = pool->workers + i;
+
+            while (
+                    worker->fd >= 0 &&
+                    worker->npending < PROC_PIPELINE &&
+                    (nretry || next < nchunks)
+                  )
+            {
+                uint64_t id = nretry ? retry[--nretry] : next++;
+
+                size_t begin = id * pool->chunk;
+
+                size_t len = (n - begin < pool->chunk) ?
+                    n - begin : pool->chunk;
+
+                if (attempts[id]++ == PROC_MAX_ATTEMPTS)
+                {
+                    for (size_t j = begin; j < begin + len; ++j)
+                        out[j] = INFINITY;
+
+                    finished[id] = true;
+                    ++done;
+
+                    continue;
+                }
+
+                worker->pending[worker->npending++] = id;
+
+                uint64_t header[3] = { id, len, dim };
+
+                if (
+                        !send_all(worker->fd, header, sizeof(header)) ||
+                        !send_all(
+                            worker->fd,
+                            positions + begin * dim,
+                            len * dim * sizeof(double)
+                            )
+                   )
+                    replace(pool, i, retry, &nretry);
+            }
+
+            busy = busy || (worker->fd >= 0 && worker->npending);
+        }
+
+        if (done == nchunks)
+            break;
+
+        // Without any workers left, the remaining chunks can't be evaluated.
+        if (!busy)
+        {
+            for (size_t id = 0; id < nchunks; ++id)
+                if (!finished[id])
+                    for (
+                            size_t j = id * pool->chunk;
+                            j < n && j < (id + 1) * pool->chunk;
+                            ++j
+                        )
+                        out[j] = INFINITY;
+
+            break;
+        }
+
+        for (size_t i = 0; i < pool->nworkers; ++i)
+        {
+            PROC_WORKER_T *worker = pool->workers + i;
+
+            // Negative descriptors are ignored by poll().
+            fds[i].fd = worker->npending ? worker->fd : -1;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+
+        if (poll(fds, pool->nworkers, -1) < 0)
+            continue;
+
+        for (size_t i = 0; i < pool->nworkers; ++i)
+        {
+            if (!fds[i].revents)
+                continue;
+
+            PROC_WORKER_T *worker = pool->workers + i;
+
+            uint64_t id = worker->pending[0];
+
+            if (receive(pool, worker, n, out))
+            {
+                finished[id] = true;
+                ++done;
+            }
+            else
+                replace(pool, i, retry, &nretry);
+        }
+    }
+}
+
+void proc_free(PROC_POOL_T *pool)
+{
+    // Closing the sockets tells the workers to exit.
+    for (size_t i = 0; i < pool->nworkers; ++i)
+        if (pool->workers[i].fd >= 0)
+            bury(pool->workers + i);
+
+    free(pool->workers);
+}
@@ -0,0 +1,121 @@
+#ifndef _PROC_H
+#define _PROC_H
+
+/*
+   This file provides definitions for a pool of worker processes which
+   evaluate the fitness function out of process, for objectives which aren't
+   thread-safe or which may crash. The pool plugs into a swarm as its batch
+   fitness function: each batch is cut into chunks which are sent to the
+   workers as binary messages over Unix-domain sockets, and the results are
+   gathered as they arrive. Every worker is kept busy with up to
+   PROC_PIPELINE chunks at once, so it can start on the next chunk while the
+   results of the previous one are being read. If a worker dies, a new one is
+   forked in its place and its outstanding chunks are sent again.
+
+   A request message consists of three uint64_t values (the chunk number, the
+   number of positions n and the dimension d) followed by n * d doubles. The
+   reply consists of the chunk number and n followed by n fitness values.
+   Everything is in native byte order. The worker side of the protocol is
+   *proc_serve()*, which works on any connected stream socket, so external
+   workers reached over TCP can speak it as well.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+
+#include "pso.h"
+
+/*
+   This constant defines the number of chunks which may be outstanding at a
+   worker at any time.
+*/
+
+#ifndef PROC_PIPELINE
+#define PROC_PIPELINE 2
+#endif
+
+/*
+   This constant defines the number of times a chunk is sent before giving up
+   on it, in which case its fitness values are set to INFINITY. This keeps a
+   position which always crashes the objective from stalling the swarm.
+*/
+
+#ifndef PROC_MAX_ATTEMPTS
+#define PROC_MAX_ATTEMPTS 3
+#endif
+
+typedef struct
+{
+    pid_t pid;
+
+    int fd;
+
+    uint64_t pending[PROC_PIPELINE];
+
+    size_t npending;
+} PROC_WORKER_T;
+
+typedef struct
+{
+    PSO_FITNESS_T fitness;
+
+    PROC_WORKER_T *workers;
+
+    size_t nworkers;
+
+    size_t chunk;
+
+    uint64_t restarts;
+} PROC_POOL_T;
+
+/*
+   This function forks *nworkers* worker processes which evaluate *fitness*,
+   and sends them batches in chunks of at most *chunk* positions. It should be
+   called before any threads are started. It returns false on invalid
+   parameters or if the workers could not be started.
+*/
+
+bool proc_initialize(
+        PROC_POOL_T *pool,
+        PSO_FITNESS_T fitness,
+        size_t nworkers,
+        size_t chunk
+        );
+
+/*
+   This function evaluates a batch with the pool passed as *ctx*. It has the
+   signature of PSO_BATCH_FITNESS_T, so it can be given to
+   *pso_initialize_batch()* together with the pool. The *bounds* aren't sent
+   to the workers, which call the fitness function without a bound (INFINITY).
+   Positions whose chunk was lost to worker
+   deaths PROC_MAX_ATTEMPTS times get a fitness of INFINITY.
+*/
+
+void proc_batch_fitness(
+        const double *positions,
+        const double *bounds,
+        size_t n,
+        size_t dim,
+        double *out,
+        void *ctx
+        );
+
+/*
+   This function serves requests arriving on the socket *fd* with *fitness*
+   until the other end closes it. It returns false on a read or write error
+   and true on a clean shutdown.
+*/
+
+bool proc_serve(int fd, PSO_FITNESS_T fitness);
+
+/*
+   This function shuts down the workers and frees the memory held by the pool
+   (but not *pool* itself).
+*/
+
+void proc_free(PROC_POOL_T *pool);
+
+#endif
@@ -1,19 +1,27 @@
 #define _GNU_SOURCE
 
+#include <inttypes.h>
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+
+#include <unistd.h>
 
 #ifndef EXCLUDE_LINUX
 #include <linux/random.h>
 #include <sys/syscall.h>
-#include <unistd.h>
 #endif
 
 #include "pso.h"
 #include "rng.h"
+#include "topology.h"
 #include "util.h"
 
 #define TEST_RANDOM_XORSHIFT_UID    "1f3a3ccab4d1cc0447e2f8c07f35cce7"
 #define TEST_RANDOM_URANDOM_UID     "58fd3704b7de783c46c1e9d11f8fe3e2"
+#define TEST_RANDOM_PHILOX_UID      "9c0e5d1b27a84f6e93d1c8b0a5f4e372"
 
 static RNG_STATE_T initialize_rng(char *phrase)
 {
@@ -24,7 +32,11 @@ static RNG_STATE_T initialize_rng(char *phrase)
 
     char *uid = rng_uid();
 
-    if (strcmp(uid, TEST_RANDOM_XORSHIFT_UID) == 0)
+    // Both of these take a 128-bit seed.
+    if (
+            strcmp(uid, TEST_RANDOM_XORSHIFT_UID) == 0 ||
+            strcmp(uid, TEST_RANDOM_PHILOX_UID) == 0
+       )
     {
         uint64_t seed[2];
 
@@ -58,288 +70,2771 @@ static RNG_STATE_T initialize_rng(char *phrase)
     return state;
 }
 
-static void generate_topology(PSO_SWARM_T *swarm)
+/*
+   With -DPSO_STATS, every thread records into its own copy of the statistics,
+   so the hot path never writes to shared memory. The public entry points flush
+   the copy into the swarm's totals with atomic additions before returning,
+   which keeps the copy empty between calls even when a thread works on several
+   swarms. Without it, these macros expand to nothing.
+*/
+
+#ifdef PSO_STATS
+
+static __thread PSO_STATS_T local_stats;
+
+/*
+   The slot of the worker the calling thread is acting as in *busy* and *idle*,
+   and the time it has spent waiting since its busy time was last counted.
+*/
+
+static __thread size_t local_slot;
+
+static __thread uint64_t local_waited;
+
+static uint64_t stats_clock(void)
 {
-    for (size_t i = 0; i < swarm->size; ++i)
-    {
-        PSO_PARTICLE_T *particle = swarm->particles + i;
+    struct timespec ts;
 
-        particle->N[swarm->k] = i;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-        for (size_t j = 0; j < swarm->k; ++j)
-            particle->N[j] = transform_integer(
-                    swarm->state,
-                    0,
-                    swarm->size - 1
-                    );
-    }
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-static void broadcast(PSO_SWARM_T *swarm, size_t index)
+static void stats_record(PSO_PHASE_T phase, uint64_t start)
 {
-    PSO_PARTICLE_T *particle = swarm->particles + index;
+    uint64_t elapsed = stats_clock() - start;
 
-    for (size_t i = 0; i <= swarm->k; ++i)
+    local_stats.nanoseconds[phase] += elapsed;
+    ++local_stats.calls[phase];
+
+    if (phase == PSO_PHASE_FITNESS)
     {
-        PSO_PARTICLE_T *peer = swarm->particles + particle->N[i];
+        unsigned bucket = 63 - __builtin_clzll(elapsed | 1);
+
+        if (bucket >= PSO_STATS_BUCKETS)
+            bucket = PSO_STATS_BUCKETS - 1;
 
-        peer->m = particle->q;
+        ++local_stats.latency[bucket];
+    }
+
+    if (phase == PSO_PHASE_LOCK || phase == PSO_PHASE_BARRIER)
+    {
+        local_stats.idle[local_slot] += elapsed;
 
-        memcpy(peer->l, particle->p, swarm->dim * sizeof(double));
+        local_waited += elapsed;
     }
 }
 
-bool pso_initialize(
-        PSO_SWARM_T *swarm,
-        PSO_FITNESS_T fitness,
-        double c,
-        double omega,
-        double *lower,
-        double *upper,
-        size_t dim,
-        size_t size,
-        size_t max_evals,
-        size_t k,
-        char *phrase
-        )
+// The last slot is shared by all the workers beyond it.
+static void stats_enter(size_t id)
 {
-    // Zero values check.
-    if (!(swarm && fitness && lower && upper && dim && size && max_evals && k))
-        goto pso_initialize_error_1;
+    local_slot = (id < PSO_STATS_THREADS) ? id : PSO_STATS_THREADS - 1;
+    local_waited = 0;
+}
 
-    // Upper bounds check.
-    if (
-            dim > TRANSFORM_MAX_DIM ||
-            size > PSO_MAX_SWARM_SIZE ||
-            k > PSO_MAX_NEIGHBORS
-       )
-        goto pso_initialize_error_1;
+// This counts the time since *start* not spent waiting as busy time.
+static void stats_busy(uint64_t start)
+{
+    local_stats.busy[local_slot] += stats_clock() - start - local_waited;
+    local_waited = 0;
+}
 
-    RNG_STATE_T state = initialize_rng(phrase);
+// The statistics are made up of uint64_t fields only.
+static void stats_flush(PSO_SWARM_T *swarm)
+{
+    uint64_t *src = (uint64_t *)&local_stats;
+    uint64_t *dst = (uint64_t *)&swarm->stats;
 
-    if (!state)
-        goto pso_initialize_error_1;
+    for (size_t i = 0; i < sizeof(PSO_STATS_T) / sizeof(uint64_t); ++i)
+        if (src[i])
+        {
+            __atomic_fetch_add(dst + i, src[i], __ATOMIC_RELAXED);
 
-    size_t len = dim * sizeof(double);
+            src[i] = 0;
+        }
+}
 
-    double *coords = malloc(size * len);
+#define STATS_START(t) uint64_t t = stats_clock()
+#define STATS_STOP(phase, t) stats_record(phase, t)
+#define STATS_COUNT(counter, n) (local_stats.counter += (n))
+#define STATS_FLUSH(swarm) stats_flush(swarm)
+#define STATS_ENTER(id) stats_enter(id)
+#define STATS_BUSY(t) stats_busy(t)
 
-    if (!coords)
-        goto pso_initialize_error_2;
+#else
 
-    // Initialize coordinates with Latin Hypercube Sampling.
-    if (!util_array_lhs(state, coords, size, dim))
-        goto pso_initialize_error_3;
+#define STATS_START(t)
+#define STATS_STOP(phase, t)
+#define STATS_COUNT(counter, n)
+#define STATS_FLUSH(swarm)
+#define STATS_ENTER(id)
+#define STATS_BUSY(t)
 
-    // Initialize constants.
-    swarm->fitness = fitness;
-    swarm->c = c;
-    swarm->omega = omega;
-    swarm->dim = dim;
-    swarm->size = size;
-    swarm->max_evals = max_evals;
-    swarm->k = k;
+#endif
 
-    swarm->state = state;
+static void lock(pthread_mutex_t *mutex)
+{
+    STATS_START(t);
 
-    // Initialize affine transform parameters
-    memcpy(swarm->lower, lower, len);
+    pthread_mutex_lock(mutex);
 
-    for (size_t i = 0; i < dim; ++i)
-        swarm->coefs[i] = upper[i] - lower[i];
+    STATS_STOP(PSO_PHASE_LOCK, t);
+}
 
-    // Do per-particle initialization.
-    generate_topology(swarm);
+static void generate_topology(PSO_SWARM_T *swarm)
+{
+    STATS_START(t);
 
-    for (size_t i = 0; i < size; ++i)
-    {
-        swarm->indices[i] = i;
+    topology_generate(&swarm->topology, swarm->state);
 
-        PSO_PARTICLE_T *particle = swarm->particles + i;
+    STATS_STOP(PSO_PHASE_TOPOLOGY, t);
+}
 
-        // Copy coordinates to particle's storage.
-        double *pos = coords + i * dim;
+// This is called when an iteration fails to improve the best fitness.
+static void regenerate_topology(PSO_SWARM_T *swarm)
+{
+    STATS_START(t);
 
-        memcpy(particle->x, pos, len);
-        memcpy(particle->p, pos, len);
-        memcpy(particle->l, pos, len);
+    if (topology_regenerate(&swarm->topology, swarm->state))
+    {
+        STATS_COUNT(regenerations, 1);
+    }
 
-        // Evaluate fitness.
-        particle->q = pso_compute_fitness(swarm, particle->x, particle->tmp);
-        particle->m = particle->q;
+    STATS_STOP(PSO_PHASE_TOPOLOGY, t);
+}
 
-        if (i == 0 || particle->q < swarm->best_fitness)
-        {
-            swarm->best_fitness = particle->q;
+// This is the published personal best of a particle.
+static double *best_row(PSO_SWARM_T *swarm, size_t index)
+{
+    return swarm->p + swarm->row[index] * swarm->stride;
+}
 
-            memcpy(swarm->best_pos, pos, len);
-        }
+// This is the other row, where a new personal best waits to be published.
+static size_t next_row(PSO_SWARM_T *swarm, size_t index)
+{
+    return (swarm->row[index] == index) ? swarm->size + index : index;
+}
 
-        // Initialize velocity.
-        for (size_t j = 0; j < dim; ++j)
-            particle->v[j] = transform_real(
-                    state,
-                    -particle->x[j],
-                    1 - particle->x[j]
-                    );
-    }
+// Only the index of the particle is passed on, not its personal best.
+static void broadcast(PSO_SWARM_T *swarm, size_t index)
+{
+    STATS_START(t);
 
-    free(coords);
+    TOPOLOGY_T *topology = &swarm->topology;
 
-    for (size_t i = 0; i < size; ++i)
+    for (
+            size_t i = topology->offsets[index];
+            i < topology->offsets[index + 1];
+            ++i
+        )
     {
-        PSO_PARTICLE_T *particle = swarm->particles + i;
-
-        size_t j = 0;
-
-        for (; j < k; ++j)
-            if (particle->q >= (swarm->particles + particle->N[j])->q)
-                break;
-
-        if (j == k)
-            broadcast(swarm, i);
+        swarm->m[topology->links[i]] = swarm->q[index];
+        swarm->l[topology->links[i]] = index;
     }
 
-    return true;
-
-pso_initialize_error_3:
-    free(coords);
-pso_initialize_error_2:
-    rng_free_state(state);
-pso_initialize_error_1:
-    return false;
+    STATS_STOP(PSO_PHASE_BROADCAST, t);
 }
 
-double pso_compute_fitness(PSO_SWARM_T *swarm, double *pos, double *tmp)
+static size_t round_up(size_t n, size_t unit)
 {
-    util_list_map(pos, tmp, swarm->coefs, swarm->lower, swarm->dim);
-
-    return swarm->fitness(tmp);
+    return (n + unit - 1) / unit * unit;
 }
 
-void pso_shuffle(PSO_SWARM_T *swarm)
+/*
+   In ownership mode, block b is made up of the particles (and the places in
+   the shuffled list) from *block_start*(swarm, b) up to the start of block
+   b + 1. The boundaries are rounded to whole cache lines of the vectors, which
+   may leave some blocks of a small swarm empty.
+*/
+
+static size_t block_start(PSO_SWARM_T *swarm, size_t b)
 {
-    util_list_shuffle(swarm->state, swarm->indices, swarm->size);
+    size_t start = round_up(
+            b * swarm->size / swarm->blocks,
+            PSO_ALIGNMENT / sizeof(double)
+            );
+
+    return (start < swarm->size) ? start : swarm->size;
 }
 
-void pso_evaluate_interval(PSO_SWARM_T *swarm, size_t begin, size_t end)
+/*
+   These are the vectorized parts of a particle update. They work on whole rows
+   of *n* doubles (the stride, which is a multiple of UTIL_LANES), relying on
+   the padding being zero. The first one writes the center of the sampling
+   hypersphere to *tmp*, using only the personal best if *l* is NULL.
+*/
+
+UTIL_INLINE void guide(
+        double *x,
+        double *p,
+        double *l,
+        double *tmp,
+        double c,
+        size_t n
+        )
 {
-    for (size_t i = begin; i <= end; ++i)
+    for (size_t i = 0; i < n; i += UTIL_LANES)
     {
-        PSO_PARTICLE_T *particle = swarm->particles + swarm->indices[i];
+#ifdef UTIL_VECTORS
+        UTIL_VECTOR_T vx, vp, vl;
 
-        if (util_list_dist(particle->p, particle->l, swarm->dim) == 0)
+        memcpy(&vx, x + i, sizeof(vx));
+        memcpy(&vp, p + i, sizeof(vp));
+
+        if (l)
         {
-            for (size_t j = 0; j < swarm->dim; ++j)
-                particle->tmp[j] =
-                    particle->x[j] +
-                    swarm->c / 2 * (
-                            particle->p[j] -
-                            particle->x[j]
-                            );
+            memcpy(&vl, l + i, sizeof(vl));
+
+            vp = vx + c / 3 * (vp + vl - 2 * vx);
         }
         else
-        {
-            for (size_t j = 0; j < swarm->dim; ++j)
-                particle->tmp[j] =
-                    particle->x[j] +
-                    swarm->c / 3 * (
-                            particle->p[j] +
-                            particle->l[j] -
-                            2 * particle->x[j]
-                            );
+            vp = vx + c / 2 * (vp - vx);
 
-        }
+        memcpy(tmp + i, &vp, sizeof(vp));
+#else
+        for (size_t j = i; j < i + UTIL_LANES; ++j)
+            tmp[j] = l ?
+                x[j] + c / 3 * (p[j] + l[j] - 2 * x[j]) :
+                x[j] + c / 2 * (p[j] - x[j]);
+#endif
+    }
+}
 
-        transform_hypersphere(
-                swarm->state,
-                util_list_dist(particle->x, particle->tmp, swarm->dim),
-                particle->tmp,
-                swarm->dim
-                );
+/*
+   This one updates the velocity and position, then reflects the particle back
+   into the unit hypercube, halving its velocity along each clamped coordinate.
+   The reflection is done with masks rather than branches.
+*/
 
-        for (size_t j = 0; j < swarm->dim; ++j)
-        {
-            particle->v[j] =
-                swarm->omega * particle->v[j] +
-                particle->tmp[j] -
-                particle->x[j];
+UTIL_INLINE void move(
+        double *x,
+        double *v,
+        double *tmp,
+        double omega,
+        size_t n
+        )
+{
+    for (size_t i = 0; i < n; i += UTIL_LANES)
+    {
+#ifdef UTIL_VECTORS
+        UTIL_VECTOR_T vx, vv, vt;
 
-            particle->x[j] += particle->v[j];
+        memcpy(&vx, x + i, sizeof(vx));
+        memcpy(&vv, v + i, sizeof(vv));
+        memcpy(&vt, tmp + i, sizeof(vt));
 
-            if (particle->x[j] < 0)
-            {
-                particle->x[j] = 0;
-                particle->v[j] *= -0.5;
-            }
-            else if (particle->x[j] > 1)
-            {
-                particle->x[j] = 1;
-                particle->v[j] *= -0.5;
-            }
-        }
+        vv = omega * vv + vt - vx;
+        vx += vv;
 
-        double fitness = pso_compute_fitness(
-                swarm,
-                particle->x,
-                particle->tmp
+        UTIL_VECTOR_T zero = { 0 };
+        UTIL_VECTOR_T one = zero + 1;
+
+        UTIL_MASK_T high = vx > one;
+        UTIL_MASK_T out = (vx < zero) | high;
+
+        vx = (UTIL_VECTOR_T)(
+                ((UTIL_MASK_T)vx & ~out) |
+                ((UTIL_MASK_T)one & high)
+                );
+
+        vv = (UTIL_VECTOR_T)(
+                ((UTIL_MASK_T)vv & ~out) |
+                ((UTIL_MASK_T)(vv * -0.5) & out)
                 );
 
-        if (fitness < particle->q)
+        memcpy(x + i, &vx, sizeof(vx));
+        memcpy(v + i, &vv, sizeof(vv));
+#else
+        for (size_t j = i; j < i + UTIL_LANES; ++j)
         {
-            memcpy(particle->p, particle->x, swarm->dim * sizeof(double));
+            v[j] = omega * v[j] + tmp[j] - x[j];
 
-            particle->q = fitness;
+            x[j] += v[j];
+
+            bool low = x[j] < 0;
+            bool high = x[j] > 1;
+
+            x[j] = low ? 0 : (high ? 1 : x[j]);
+            v[j] = (low || high) ? v[j] * -0.5 : v[j];
         }
+#endif
     }
 }
 
-bool pso_finalize(PSO_SWARM_T *swarm)
+/*
+   The kernels (see PSO_KERNELS_T) are assembled from the parts above with the
+   dimension and the stride as parameters. The generic kernels pass the
+   runtime values, and KERNELS(d) instantiates kernels in which both are
+   constants, so that once everything is inlined every loop has a constant trip
+   count. Like the parts, they are cloned for wider instruction sets.
+*/
+
+UTIL_INLINE void guide_kernel(
+        double *x,
+        double *p,
+        double *l,
+        double *tmp,
+        double c,
+        size_t stride
+        )
 {
-    double old_fitness = swarm->best_fitness;
+    // The check lets the compiler drop the neighbourhood terms for NULL.
+    if (l)
+        guide(x, p, l, tmp, c, stride);
+    else
+        guide(x, p, NULL, tmp, c, stride);
+}
 
-    for (size_t i = 0; i < swarm->size; ++i)
-    {
-        PSO_PARTICLE_T *particle = swarm->particles + swarm->indices[i];
+UTIL_INLINE void move_kernel(
+        RNG_STATE_T state,
+        double *x,
+        double *v,
+        double *tmp,
+        double omega,
+        size_t dim,
+        size_t stride
+        )
+{
+    STATS_START(h);
 
-        if (particle->q < swarm->best_fitness)
-        {
-            swarm->best_fitness = particle->q;
+    transform_hypersphere_inline(
+            state,
+            util_list_dist_inline(x, tmp, stride),
+            tmp,
+            dim
+            );
 
-            memcpy(swarm->best_pos, particle->p, swarm->dim * sizeof(double));
-        }
+    STATS_STOP(PSO_PHASE_HYPERSPHERE, h);
+
+    move(x, v, tmp, omega, stride);
+}
+
+UTIL_INLINE void map_kernel(
+        double *in,
+        double *out,
+        double *m,
+        double *b,
+        size_t dim
+        )
+{
+    for (size_t i = 0; i < dim; ++i)
+        out[i] = fma(in[i], m[i], b[i]);
+}
+
+#define UNIT (PSO_ALIGNMENT / sizeof(double))
+
+UTIL_CLONES static void guide_generic(
+        double *x,
+        double *p,
+        double *l,
+        double *tmp,
+        double c,
+        size_t dim
+        )
+{
+    guide_kernel(x, p, l, tmp, c, round_up(dim, UNIT));
+}
+
+UTIL_CLONES static void move_generic(
+        RNG_STATE_T state,
+        double *x,
+        double *v,
+        double *tmp,
+        double omega,
+        size_t dim
+        )
+{
+    move_kernel(state, x, v, tmp, omega, dim, round_up(dim, UNIT));
+}
 
-        if (particle->q < particle->m)
-            broadcast(swarm, swarm->indices[i]);
+#ifndef EXCLUDE_KERNELS
+#define KERNELS(d) \
+    UTIL_CLONES static void guide_##d( \
+            double *x, \
+            double *p, \
+            double *l, \
+            double *tmp, \
+            double c, \
+            size_t dim \
+            ) \
+    { \
+        (void)dim; \
+        guide_kernel(x, p, l, tmp, c, round_up(d, UNIT)); \
+    } \
+    \
+    UTIL_CLONES static void move_##d( \
+            RNG_STATE_T state, \
+            double *x, \
+            double *v, \
+            double *tmp, \
+            double omega, \
+            size_t dim \
+            ) \
+    { \
+        (void)dim; \
+        move_kernel(state, x, v, tmp, omega, d, round_up(d, UNIT)); \
+    } \
+    \
+    static void map_##d(double *in, double *out, double *m, double *b, \
+            size_t dim) \
+    { \
+        (void)dim; \
+        map_kernel(in, out, m, b, d); \
     }
 
-    if (swarm->best_fitness == old_fitness)
-        generate_topology(swarm);
+KERNELS(2)
+KERNELS(3)
+KERNELS(4)
+KERNELS(5)
+KERNELS(6)
+KERNELS(7)
+KERNELS(8)
+KERNELS(9)
+KERNELS(10)
+KERNELS(11)
+KERNELS(12)
+KERNELS(13)
+KERNELS(14)
+KERNELS(15)
+KERNELS(16)
+
+#define KERNEL_ENTRY(d) [d] = { guide_##d, move_##d, map_##d }
+
+static const PSO_KERNELS_T kernels[PSO_KERNEL_MAX_DIM + 1] =
+{
+    KERNEL_ENTRY(2),
+    KERNEL_ENTRY(3),
+    KERNEL_ENTRY(4),
+    KERNEL_ENTRY(5),
+    KERNEL_ENTRY(6),
+    KERNEL_ENTRY(7),
+    KERNEL_ENTRY(8),
+    KERNEL_ENTRY(9),
+    KERNEL_ENTRY(10),
+    KERNEL_ENTRY(11),
+    KERNEL_ENTRY(12),
+    KERNEL_ENTRY(13),
+    KERNEL_ENTRY(14),
+    KERNEL_ENTRY(15),
+    KERNEL_ENTRY(16)
+};
+#endif
 
-    if (swarm->max_evals >= swarm->size)
-    {
-        swarm->max_evals -= swarm->size;
+static PSO_KERNELS_T select_kernels(size_t dim)
+{
+#ifndef EXCLUDE_KERNELS
+    if (dim <= PSO_KERNEL_MAX_DIM && kernels[dim].guide)
+        return kernels[dim];
+#else
+    (void)dim;
+#endif
 
-        return true;
+    return (PSO_KERNELS_T){ guide_generic, move_generic, util_list_map };
+}
+
+/*
+   This points the swarm's arrays into *arena*, which must be at least as large
+   as *allocate()* makes it for the same parameters.
+*/
+
+static void carve(
+        PSO_SWARM_T *swarm,
+        void *arena,
+        size_t dim,
+        size_t size,
+        bool batch
+        )
+{
+    size_t unit = PSO_ALIGNMENT / sizeof(double);
+
+    size_t stride = round_up(dim, unit);
+
+    size_t matrix = size * stride;
+
+    size_t vector = round_up(size, unit);
+
+    double *cursor = (double *)arena;
+
+    swarm->arena = arena;
+    swarm->stride = stride;
+    swarm->kernels = select_kernels(dim);
+
+    swarm->x = cursor;
+    cursor += matrix;
+    swarm->tmp = cursor;
+    cursor += matrix;
+    swarm->v = cursor;
+    cursor += matrix;
+    swarm->p = cursor;
+    cursor += 2 * matrix;
+
+    swarm->q = cursor;
+    cursor += vector;
+    swarm->m = cursor;
+    cursor += vector;
+
+    swarm->lower = cursor;
+    cursor += stride;
+    swarm->coefs = cursor;
+    cursor += stride;
+    swarm->best_pos = cursor;
+    cursor += stride;
+
+    // These share the block since uint64_t and double have the same size.
+    swarm->indices = (uint64_t *)cursor;
+    cursor += vector;
+    swarm->l = (uint64_t *)cursor;
+    cursor += vector;
+    swarm->row = (uint64_t *)cursor;
+    cursor += vector;
+    swarm->changed = (uint64_t *)cursor;
+    cursor += vector;
+    swarm->ends = (uint64_t *)cursor;
+    cursor += vector;
+    swarm->counts = (uint64_t *)cursor;
+    cursor += vector;
+    swarm->order = (uint64_t *)cursor;
+    cursor += vector;
+    swarm->pending = (uint64_t *)cursor;
+    cursor += vector;
+
+    if (batch)
+    {
+        swarm->batch_pos = cursor;
+        cursor += round_up(size * dim, unit);
+        swarm->batch_out = cursor;
     }
     else
+    {
+        swarm->batch_pos = NULL;
+        swarm->batch_out = NULL;
+    }
+}
+
+/*
+   All of the swarm's arrays are carved out of a single block. The particle
+   matrices have one row per particle, and every row (like every array) starts
+   on a PSO_ALIGNMENT boundary. The memory is zeroed, so the padding at the end
+   of each row is harmless to any loop that runs over it.
+*/
+
+static bool allocate(
+        PSO_SWARM_T *swarm,
+        size_t dim,
+        size_t size,
+        bool batch
+        )
+{
+    size_t unit = PSO_ALIGNMENT / sizeof(double);
+
+    size_t stride = round_up(dim, unit);
+
+    size_t matrix = size * stride;
+
+    size_t vector = round_up(size, unit);
+
+    size_t total = 5 * matrix + 10 * vector + 3 * stride;
+
+    if (batch)
+        total += round_up(size * dim, unit) + vector;
+
+    void *arena;
+
+    if (posix_memalign(&arena, PSO_ALIGNMENT, total * sizeof(double)) != 0)
         return false;
+
+    memset(arena, 0, total * sizeof(double));
+
+    carve(swarm, arena, dim, size, batch);
+
+    swarm->footprint = total * sizeof(double);
+
+    for (size_t i = 0; i < size; ++i)
+        swarm->row[i] = i;
+
+    return true;
 }
 
-void pso_write_optimum(PSO_SWARM_T *swarm, PSO_RESULTS_T *results)
+// Every call to the batch fitness function goes through here to be timed.
+static void evaluate_batch(
+        PSO_SWARM_T *swarm,
+        double *positions,
+        double *bounds,
+        size_t n,
+        double *out
+        )
 {
-    util_list_map(
-            swarm->best_pos,
-            results->pos,
-            swarm->coefs,
-            swarm->lower,
-            swarm->dim
-            );
+    STATS_START(t);
 
-    results->fitness = swarm->best_fitness;
+    swarm->batch_fitness(positions, bounds, n, swarm->dim, out, swarm->ctx);
+
+    STATS_STOP(PSO_PHASE_FITNESS, t);
+    STATS_COUNT(evaluations, n);
 }
 
-void pso_free(PSO_SWARM_T *swarm)
+/*
+   This makes every particle forget what it has heard from its neighbourhood,
+   then lets each particle which is better than all of the others it informs
+   share its position.
+*/
+
+static void introduce(PSO_SWARM_T *swarm)
 {
-    rng_free_state(swarm->state);
+    TOPOLOGY_T *topology = &swarm->topology;
+
+    for (size_t i = 0; i < swarm->size; ++i)
+    {
+        swarm->l[i] = i;
+        swarm->m[i] = swarm->q[i];
+    }
+
+    for (size_t i = 0; i < swarm->size; ++i)
+    {
+        size_t j = topology->offsets[i];
+
+        // The last link is the particle itself.
+        for (; j + 1 < topology->offsets[i + 1]; ++j)
+            if (swarm->q[i] >= swarm->q[topology->links[j]])
+                break;
+
+        if (j + 1 == topology->offsets[i + 1])
+            broadcast(swarm, i);
+    }
+}
+
+/*
+   This places every particle except *keep* (which may be *swarm*->size to
+   place them all) at its row of *coords*, evaluates it and gives it a random
+   velocity, then draws a new topology and lets each particle which is better
+   than all of its informants share its position. The particle *keep* keeps
+   its position, velocity and personal best.
+*/
+
+static void seed(PSO_SWARM_T *swarm, double *coords, size_t keep)
+{
+    size_t dim = swarm->dim;
+
+    size_t len = dim * sizeof(double);
+
+    // Evaluate the whole swarm in one go if possible.
+    if (swarm->batch_fitness)
+    {
+        util_array_map(
+                coords,
+                swarm->batch_pos,
+                swarm->coefs,
+                swarm->lower,
+                swarm->size,
+                dim
+                );
+
+        evaluate_batch(
+                swarm,
+                swarm->batch_pos,
+                NULL,
+                swarm->size,
+                swarm->batch_out
+                );
+    }
+
+    generate_topology(swarm);
+
+    for (size_t i = 0; i < swarm->size; ++i)
+    {
+        swarm->indices[i] = i;
+
+        double *x = swarm->x + i * swarm->stride;
+
+        if (i == keep)
+            continue;
+
+        swarm->row[i] = i;
+
+        // Copy coordinates to particle's storage.
+        double *pos = coords + i * dim;
+
+        memcpy(x, pos, len);
+        memcpy(swarm->p + i * swarm->stride, pos, len);
+
+        // Evaluate fitness.
+        if (swarm->batch_fitness)
+            swarm->q[i] = swarm->batch_out[i];
+        else
+            swarm->q[i] = pso_compute_fitness(
+                    swarm,
+                    x,
+                    swarm->tmp + i * swarm->stride,
+                    INFINITY
+                    );
+
+        if (swarm->q[i] < swarm->best_fitness)
+        {
+            swarm->best_fitness = swarm->q[i];
+
+            memcpy(swarm->best_pos, pos, len);
+        }
+
+        // Initialize velocity.
+        double *v = swarm->v + i * swarm->stride;
+
+        for (size_t j = 0; j < dim; ++j)
+            v[j] = transform_real(swarm->state, -x[j], 1 - x[j]);
+    }
+
+    introduce(swarm);
+}
+
+static bool initialize(
+        PSO_SWARM_T *swarm,
+        PSO_FITNESS_T fitness,
+        PSO_BATCH_FITNESS_T batch_fitness,
+        void *ctx,
+        double c,
+        double omega,
+        double *lower,
+        double *upper,
+        size_t dim,
+        size_t size,
+        size_t max_evals,
+        size_t k,
+        char *phrase
+        )
+{
+    // Zero values check.
+    if (!(swarm && (fitness || batch_fitness) && lower && upper))
+        goto pso_initialize_error_1;
+
+    if (!(dim && size && max_evals && k))
+        goto pso_initialize_error_1;
+
+    // Upper bounds check.
+    if (k > PSO_MAX_NEIGHBORS)
+        goto pso_initialize_error_1;
+
+    RNG_STATE_T state = initialize_rng(phrase);
+
+    if (!state)
+        goto pso_initialize_error_1;
+
+    size_t len = dim * sizeof(double);
+
+    double *coords = malloc(size * len);
+
+    if (!coords)
+        goto pso_initialize_error_2;
+
+    // Initialize coordinates with Latin Hypercube Sampling.
+    if (!util_array_lhs(state, coords, size, dim))
+        goto pso_initialize_error_3;
+
+    if (!allocate(swarm, dim, size, batch_fitness))
+        goto pso_initialize_error_3;
+
+    if (!topology_initialize(&swarm->topology, TOPOLOGY_ADAPTIVE, size, k))
+        goto pso_initialize_error_4;
+
+    swarm->states = malloc(size * sizeof(RNG_STATE_T));
+
+    if (!swarm->states)
+        goto pso_initialize_error_5;
+
+    // Split off a substream for each particle.
+    size_t num_states = 0;
+
+    for (; num_states < size; ++num_states)
+    {
+        RNG_STATE_T *substate = swarm->states + num_states;
+
+        *substate = rng_allocate_state();
+
+        if (!*substate)
+            goto pso_initialize_error_6;
+
+        rng_copy_state(*substate, state);
+        rng_jump(state);
+    }
+
+    // Initialize constants.
+    swarm->fitness = fitness;
+    swarm->batch_fitness = batch_fitness;
+    swarm->batch_split = false;
+    swarm->ctx = ctx;
+    swarm->c = c;
+    swarm->omega = omega;
+    swarm->dim = dim;
+    swarm->size = size;
+    swarm->max_evals = max_evals;
+    swarm->k = k;
+
+    swarm->state = state;
+
+    pthread_mutex_init(&swarm->mutex, NULL);
+
+    swarm->cache = NULL;
+
+    memset(&swarm->stats, 0, sizeof(PSO_STATS_T));
+    memset(&swarm->termination, 0, sizeof(PSO_TERMINATION_T));
+    memset(&swarm->restart, 0, sizeof(PSO_RESTART_T));
+
+    swarm->reason = PSO_STOP_NONE;
+    swarm->iteration = 0;
+    swarm->restarts = 0;
+    swarm->blocks = 0;
+
+    // Initialize affine transform parameters
+    memcpy(swarm->lower, lower, len);
+
+    for (size_t i = 0; i < dim; ++i)
+        swarm->coefs[i] = upper[i] - lower[i];
+
+    swarm->best_fitness = INFINITY;
+
+    memcpy(swarm->best_pos, coords, len);
+
+    seed(swarm, coords, size);
+
+    free(coords);
+
+    STATS_FLUSH(swarm);
+
+    return true;
+
+pso_initialize_error_6:
+    for (size_t i = 0; i < num_states; ++i)
+        rng_free_state(swarm->states[i]);
+
+    free(swarm->states);
+pso_initialize_error_5:
+    topology_free(&swarm->topology);
+pso_initialize_error_4:
+    free(swarm->arena);
+pso_initialize_error_3:
+    free(coords);
+pso_initialize_error_2:
+    rng_free_state(state);
+pso_initialize_error_1:
+    return false;
+}
+
+bool pso_initialize(
+        PSO_SWARM_T *swarm,
+        PSO_FITNESS_T fitness,
+        double c,
+        double omega,
+        double *lower,
+        double *upper,
+        size_t dim,
+        size_t size,
+        size_t max_evals,
+        size_t k,
+        char *phrase
+        )
+{
+    if (!fitness)
+        return false;
+
+    return initialize(
+            swarm,
+            fitness,
+            NULL,
+            NULL,
+            c,
+            omega,
+            lower,
+            upper,
+            dim,
+            size,
+            max_evals,
+            k,
+            phrase
+            );
+}
+
+bool pso_initialize_batch(
+        PSO_SWARM_T *swarm,
+        PSO_BATCH_FITNESS_T batch_fitness,
+        void *ctx,
+        double c,
+        double omega,
+        double *lower,
+        double *upper,
+        size_t dim,
+        size_t size,
+        size_t max_evals,
+        size_t k,
+        char *phrase
+        )
+{
+    if (!batch_fitness)
+        return false;
+
+    return initialize(
+            swarm,
+            NULL,
+            batch_fitness,
+            ctx,
+            c,
+            omega,
+            lower,
+            upper,
+            dim,
+            size,
+            max_evals,
+            k,
+            phrase
+            );
+}
+
+bool pso_enable_cache(PSO_SWARM_T *swarm, size_t capacity, double step)
+{
+    if (!swarm || swarm->cache)
+        return false;
+
+    CACHE_T *cache = malloc(sizeof(CACHE_T));
+
+    if (!cache)
+        return false;
+
+    if (!cache_initialize(cache, capacity, swarm->dim, step))
+    {
+        free(cache);
+
+        return false;
+    }
+
+    swarm->cache = cache;
+
+    return true;
+}
+
+void pso_cache_stats(PSO_SWARM_T *swarm, uint64_t *hits, uint64_t *misses)
+{
+    *hits = swarm->cache ?
+        __atomic_load_n(&swarm->cache->hits, __ATOMIC_RELAXED) : 0;
+
+    *misses = swarm->cache ?
+        __atomic_load_n(&swarm->cache->misses, __ATOMIC_RELAXED) : 0;
+}
+
+static double wall_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+void pso_set_termination(PSO_SWARM_T *swarm, PSO_TERMINATION_T *termination)
+{
+    swarm->termination = *termination;
+
+    swarm->last_improvement = swarm->iteration;
+    swarm->window_start = swarm->iteration;
+    swarm->window_fitness = swarm->best_fitness;
+
+    swarm->started = termination->time_limit > 0 ? wall_clock() : 0;
+}
+
+void pso_set_restart(PSO_SWARM_T *swarm, PSO_RESTART_T *restart)
+{
+    swarm->restart = *restart;
+}
+
+bool pso_set_topology(PSO_SWARM_T *swarm, TOPOLOGY_KIND_T kind)
+{
+    TOPOLOGY_T topology;
+
+    if (!topology_initialize(&topology, kind, swarm->size, swarm->k))
+        return false;
+
+    topology_free(&swarm->topology);
+
+    swarm->topology = topology;
+
+    generate_topology(swarm);
+
+    introduce(swarm);
+
+    STATS_FLUSH(swarm);
+
+    return true;
+}
+
+bool pso_set_ownership(PSO_SWARM_T *swarm, size_t blocks)
+{
+    if (blocks > swarm->size)
+        return false;
+
+    swarm->blocks = blocks;
+
+    // Every particle starts out in its own block.
+    for (size_t i = 0; i < swarm->size; ++i)
+        swarm->indices[i] = i;
+
+    return true;
+}
+
+static char *stop_names[] =
+{
+    "none",
+    "budget",
+    "target",
+    "stagnation",
+    "tolerance",
+    "diameter",
+    "deadline"
+};
+
+char *pso_stop_name(PSO_STOP_T reason)
+{
+    return stop_names[reason];
+}
+
+double pso_compute_fitness(
+        PSO_SWARM_T *swarm,
+        double *pos,
+        double *tmp,
+        double bound
+        )
+{
+    swarm->kernels.map(pos, tmp, swarm->coefs, swarm->lower, swarm->dim);
+
+    double fitness;
+
+    if (swarm->batch_fitness)
+    {
+        evaluate_batch(swarm, tmp, &bound, 1, &fitness);
+
+        return fitness;
+    }
+
+    if (!swarm->cache)
+    {
+        STATS_START(t);
+
+        fitness = swarm->fitness(tmp, bound);
+
+        STATS_STOP(PSO_PHASE_FITNESS, t);
+        STATS_COUNT(evaluations, 1);
+
+        return fitness;
+    }
+
+    // The cache is keyed on the unit hypercube coordinates.
+    int64_t key[swarm->dim];
+
+    uint64_t hash = cache_key(swarm->cache, pos, key);
+
+    if (!cache_lookup(swarm->cache, key, hash, bound, &fitness))
+    {
+        STATS_START(t);
+
+        fitness = swarm->fitness(tmp, bound);
+
+        STATS_STOP(PSO_PHASE_FITNESS, t);
+        STATS_COUNT(evaluations, 1);
+
+        cache_insert(swarm->cache, key, hash, bound, fitness);
+    }
+
+    return fitness;
+}
+
+double *pso_personal_best(PSO_SWARM_T *swarm, size_t i)
+{
+    return best_row(swarm, i);
+}
+
+void pso_shuffle(PSO_SWARM_T *swarm)
+{
+    STATS_START(t);
+
+    if (!swarm->blocks)
+        util_list_shuffle(swarm->state, swarm->indices, swarm->size);
+
+    // Particles never leave their block, so the blocks are shuffled apart.
+    for (size_t b = 0; b < swarm->blocks; ++b)
+    {
+        size_t begin = block_start(swarm, b);
+        size_t end = block_start(swarm, b + 1);
+
+        if (end > begin)
+            util_list_shuffle(
+                    swarm->state,
+                    swarm->indices + begin,
+                    end - begin
+                    );
+    }
+
+    STATS_STOP(PSO_PHASE_SHUFFLE, t);
+    STATS_FLUSH(swarm);
+}
+
+/*
+   The entries of *changed* are places in the shuffled list, with this bit set
+   if the particle has a new personal best waiting to be published.
+*/
+
+#define IMPROVED ((uint64_t)1 << 63)
+
+void pso_evaluate_interval(PSO_SWARM_T *swarm, size_t begin, size_t end)
+{
+    size_t dim = swarm->dim;
+
+    uint64_t *changed = swarm->changed + begin;
+
+    size_t count = 0;
+
+    for (size_t i = begin; i <= end; ++i)
+    {
+        size_t index = swarm->indices[i];
+
+        swarm->order[index] = i;
+
+        double *x = swarm->x + index * swarm->stride;
+        double *tmp = swarm->tmp + index * swarm->stride;
+        double *v = swarm->v + index * swarm->stride;
+        double *p = best_row(swarm, index);
+
+        // Particles which know of nothing better than themselves go it alone.
+        double *l = (swarm->l[index] == index) ?
+            NULL : best_row(swarm, swarm->l[index]);
+
+        STATS_START(t);
+
+        swarm->kernels.guide(x, p, l, tmp, swarm->c, dim);
+
+        swarm->kernels.move(
+                swarm->states[index],
+                x,
+                v,
+                tmp,
+                swarm->omega,
+                dim
+                );
+
+        STATS_STOP(PSO_PHASE_UPDATE, t);
+
+        // In batch mode, evaluation is deferred to pso_finalize().
+        if (swarm->batch_fitness)
+        {
+            swarm->kernels.map(
+                    x,
+                    swarm->batch_pos + index * dim,
+                    swarm->coefs,
+                    swarm->lower,
+                    dim
+                    );
+
+            continue;
+        }
+
+        double fitness = pso_compute_fitness(swarm, x, tmp, swarm->q[index]);
+
+        if (fitness < swarm->q[index])
+        {
+            memcpy(
+                    swarm->p + next_row(swarm, index) * swarm->stride,
+                    x,
+                    dim * sizeof(double)
+                  );
+
+            swarm->q[index] = fitness;
+
+            changed[count++] = i | IMPROVED;
+
+            STATS_COUNT(improvements, 1);
+        }
+        // Particles may also have news from an earlier iteration.
+        else if (swarm->q[index] < swarm->m[index])
+            changed[count++] = i;
+    }
+
+    swarm->ends[begin] = end + 1;
+    swarm->counts[begin] = count;
+
+    STATS_FLUSH(swarm);
+}
+
+// This is the widest extent of the personal bests along any axis.
+static double diameter(PSO_SWARM_T *swarm)
+{
+    double widest = 0;
+
+    for (size_t j = 0; j < swarm->dim; ++j)
+    {
+        double low = best_row(swarm, 0)[j];
+        double high = low;
+
+        for (size_t i = 1; i < swarm->size; ++i)
+        {
+            double val = best_row(swarm, i)[j];
+
+            low = (val < low) ? val : low;
+            high = (val > high) ? val : high;
+        }
+
+        if (high - low > widest)
+            widest = high - low;
+    }
+
+    return widest;
+}
+
+/*
+   This enlarges the swarm to *size* particles, carrying over the transform
+   parameters, the best position, the kind of topology and the particle *keep*.
+   The new particles get fresh substreams, split off the swarm's generator as
+   in initialization. The rest of the new storage is left zeroed (and the
+   random links undrawn) for *seed()* to fill in. It returns false, leaving the
+   swarm untouched, on a memory allocation error.
+*/
+
+static bool grow(PSO_SWARM_T *swarm, size_t size, size_t keep)
+{
+    RNG_STATE_T *states = realloc(swarm->states, size * sizeof(RNG_STATE_T));
+
+    if (!states)
+        goto grow_error_1;
+
+    swarm->states = states;
+
+    size_t num_states = swarm->size;
+
+    for (; num_states < size; ++num_states)
+    {
+        states[num_states] = rng_allocate_state();
+
+        if (!states[num_states])
+            goto grow_error_2;
+
+        rng_copy_state(states[num_states], swarm->state);
+        rng_jump(swarm->state);
+    }
+
+    TOPOLOGY_T topology;
+
+    if (!topology_initialize(
+                &topology,
+                swarm->topology.kind,
+                size,
+                swarm->k
+                ))
+        goto grow_error_2;
+
+    PSO_SWARM_T old = *swarm;
+
+    if (!allocate(swarm, swarm->dim, size, swarm->batch_fitness))
+        goto grow_error_3;
+
+    topology_free(&old.topology);
+
+    swarm->topology = topology;
+
+    size_t vector = swarm->dim * sizeof(double);
+
+    memcpy(swarm->lower, old.lower, vector);
+    memcpy(swarm->coefs, old.coefs, vector);
+    memcpy(swarm->best_pos, old.best_pos, vector);
+
+    size_t offset = keep * swarm->stride;
+
+    memcpy(swarm->x + offset, old.x + offset, vector);
+    memcpy(swarm->v + offset, old.v + offset, vector);
+    memcpy(swarm->p + offset, best_row(&old, keep), vector);
+
+    swarm->q[keep] = old.q[keep];
+
+    free(old.arena);
+
+    swarm->size = size;
+
+    return true;
+
+grow_error_3:
+    topology_free(&topology);
+grow_error_2:
+    // The states array may stay larger than needed.
+    for (size_t i = swarm->size; i < num_states; ++i)
+        rng_free_state(states[i]);
+grow_error_1:
+    return false;
+}
+
+/*
+   This restarts the swarm as described for PSO_RESTART_T, unless the budget
+   can't cover the evaluations of the new particles.
+*/
+
+static void restart(PSO_SWARM_T *swarm)
+{
+    size_t size = swarm->size;
+
+    if (swarm->restart.growth > 1)
+    {
+        size = (size_t)ceil(swarm->restart.growth * size);
+
+        if (swarm->restart.max_size && size > swarm->restart.max_size)
+            size = swarm->restart.max_size;
+
+        if (size < swarm->size)
+            size = swarm->size;
+    }
+
+    // In batch mode, the kept particle is evaluated again with the others.
+    size_t cost = swarm->batch_fitness ? size : size - 1;
+
+    // Leave enough for at least one more iteration.
+    if (swarm->max_evals < cost + size)
+        return;
+
+    size_t keep = 0;
+
+    for (size_t i = 1; i < swarm->size; ++i)
+        if (swarm->q[i] < swarm->q[keep])
+            keep = i;
+
+    if (size > swarm->size && !grow(swarm, size, keep))
+        cost = swarm->batch_fitness ? swarm->size : swarm->size - 1;
+
+    double *coords = malloc(swarm->size * swarm->dim * sizeof(double));
+
+    if (!coords)
+        return;
+
+    if (!util_array_lhs(swarm->state, coords, swarm->size, swarm->dim))
+    {
+        free(coords);
+
+        return;
+    }
+
+    seed(swarm, coords, keep);
+
+    free(coords);
+
+    swarm->max_evals -= cost;
+
+    ++swarm->restarts;
+
+    // The stopping rules start counting again.
+    swarm->last_improvement = swarm->iteration;
+    swarm->window_start = swarm->iteration;
+    swarm->window_fitness = swarm->best_fitness;
+}
+
+/*
+   This counts an iteration and checks the stopping rules other than the
+   budget, given the best fitness before the iteration. The rules are ordered
+   roughly by cost, so that the cheap ones are checked first.
+*/
+
+static PSO_STOP_T check_termination(PSO_SWARM_T *swarm, double old_fitness)
+{
+    PSO_TERMINATION_T *rules = &swarm->termination;
+
+    ++swarm->iteration;
+
+    if (swarm->best_fitness < old_fitness)
+        swarm->last_improvement = swarm->iteration;
+
+    if (rules->has_target && swarm->best_fitness <= rules->target)
+        return PSO_STOP_TARGET;
+
+    if (
+            rules->stagnation &&
+            swarm->iteration - swarm->last_improvement >= rules->stagnation
+       )
+        return PSO_STOP_STAGNATION;
+
+    if (
+            rules->window &&
+            swarm->iteration - swarm->window_start >= rules->window
+       )
+    {
+        double gain = swarm->window_fitness - swarm->best_fitness;
+
+        double tolerance = rules->abs_tolerance +
+            rules->rel_tolerance * fabs(swarm->best_fitness);
+
+        if (gain <= tolerance)
+            return PSO_STOP_TOLERANCE;
+
+        swarm->window_start = swarm->iteration;
+        swarm->window_fitness = swarm->best_fitness;
+    }
+
+    if (rules->diameter > 0 && diameter(swarm) < rules->diameter)
+        return PSO_STOP_DIAMETER;
+
+    if (
+            rules->time_limit > 0 &&
+            wall_clock() - swarm->started >= rules->time_limit
+       )
+        return PSO_STOP_DEADLINE;
+
+    return PSO_STOP_NONE;
+}
+
+// This marks place *i* in the shuffled list as having news to share.
+static void mark(PSO_SWARM_T *swarm, size_t i)
+{
+    swarm->pending[i / 64] |= (uint64_t)1 << i % 64;
+}
+
+/*
+   This visits the marked places in the shuffled list in order. A particle
+   which is better than anything it has heard of updates the best position and
+   tells the particles it informs, which may give those further down the list
+   news of their own, so they are marked in turn. Those earlier in the list
+   pass theirs on in the next iteration. Only the marked places are visited,
+   rather than the whole swarm.
+*/
+
+static void spread(PSO_SWARM_T *swarm)
+{
+    size_t words = (swarm->size + 63) / 64;
+
+    for (size_t w = 0; w < words; ++w)
+        while (swarm->pending[w])
+        {
+            size_t i = w * 64 + __builtin_ctzll(swarm->pending[w]);
+
+            swarm->pending[w] &= swarm->pending[w] - 1;
+
+            size_t index = swarm->indices[i];
+
+            if (!(swarm->q[index] < swarm->m[index]))
+                continue;
+
+            if (swarm->q[index] < swarm->best_fitness)
+            {
+                swarm->best_fitness = swarm->q[index];
+
+                memcpy(
+                        swarm->best_pos,
+                        best_row(swarm, index),
+                        swarm->dim * sizeof(double)
+                      );
+            }
+
+            broadcast(swarm, index);
+
+            TOPOLOGY_T *topology = &swarm->topology;
+
+            // The last link is the particle itself.
+            for (
+                    size_t j = topology->offsets[index];
+                    j + 1 < topology->offsets[index + 1];
+                    ++j
+                )
+            {
+                size_t n = topology->links[j];
+
+                if (swarm->order[n] > i && swarm->q[n] < swarm->m[n])
+                    mark(swarm, swarm->order[n]);
+            }
+        }
+}
+
+/*
+   In batch mode, this evaluates the particles [begin, end) by index, each
+   bounded by its personal best.
+*/
+
+static void evaluate_rows(PSO_SWARM_T *swarm, size_t begin, size_t end)
+{
+    if (end > begin)
+        evaluate_batch(
+                swarm,
+                swarm->batch_pos + begin * swarm->dim,
+                swarm->q + begin,
+                end - begin,
+                swarm->batch_out + begin
+                );
+}
+
+/*
+   This is *pso_finalize()*, except that in batch mode the swarm has already
+   been *evaluated* if the flag is set.
+*/
+
+static bool finalize(PSO_SWARM_T *swarm, bool evaluated)
+{
+    STATS_START(t);
+
+    double old_fitness = swarm->best_fitness;
+
+    if (swarm->batch_fitness)
+    {
+        if (!evaluated)
+            evaluate_rows(swarm, 0, swarm->size);
+
+        // Nothing else is running, so the rows can be written in place.
+        for (size_t i = 0; i < swarm->size; ++i)
+        {
+            size_t index = swarm->indices[i];
+
+            if (swarm->batch_out[index] < swarm->q[index])
+            {
+                memcpy(
+                        best_row(swarm, index),
+                        swarm->x + index * swarm->stride,
+                        swarm->dim * sizeof(double)
+                      );
+
+                swarm->q[index] = swarm->batch_out[index];
+
+                STATS_COUNT(improvements, 1);
+            }
+
+            if (swarm->q[index] < swarm->m[index])
+                mark(swarm, i);
+        }
+    }
+    else
+        // Each interval left a list of its changes at its beginning.
+        for (
+                size_t begin = 0;
+                begin < swarm->size && swarm->ends[begin] > begin;
+                begin = swarm->ends[begin]
+            )
+            for (size_t j = 0; j < swarm->counts[begin]; ++j)
+            {
+                uint64_t entry = swarm->changed[begin + j];
+
+                size_t i = entry & ~IMPROVED;
+
+                size_t index = swarm->indices[i];
+
+                if (entry & IMPROVED)
+                    swarm->row[index] = next_row(swarm, index);
+
+                mark(swarm, i);
+            }
+
+    spread(swarm);
+
+    if (swarm->best_fitness == old_fitness)
+        regenerate_topology(swarm);
+
+    PSO_RESTART_T *policy = &swarm->restart;
+
+    // The iteration hasn't been counted yet, hence the + 1.
+    if (
+            (
+                policy->stagnation &&
+                swarm->best_fitness == old_fitness &&
+                swarm->iteration + 1 - swarm->last_improvement >=
+                policy->stagnation
+            ) ||
+            (policy->diameter > 0 && diameter(swarm) < policy->diameter)
+       )
+        restart(swarm);
+
+    swarm->reason = check_termination(swarm, old_fitness);
+
+    if (swarm->reason == PSO_STOP_NONE && swarm->max_evals < swarm->size)
+        swarm->reason = PSO_STOP_BUDGET;
+
+    bool running = swarm->reason == PSO_STOP_NONE;
+
+    if (running)
+        swarm->max_evals -= swarm->size;
+
+    STATS_STOP(PSO_PHASE_FINALIZE, t);
+    STATS_FLUSH(swarm);
+
+    return running;
+}
+
+bool pso_finalize(PSO_SWARM_T *swarm)
+{
+    return finalize(swarm, false);
+}
+
+void pso_set_batch_split(PSO_SWARM_T *swarm, bool split)
+{
+    swarm->batch_split = split;
+}
+
+/*
+   In asynchronous mode, each worker keeps the particles waiting for it in a
+   ring buffer large enough for the whole swarm. The owner takes particles from
+   the front and puts them back at the end, while idle workers steal from the
+   end. Each queue has its own lock, which is only ever held for a few
+   instructions.
+*/
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+
+    uint64_t *items;
+
+    size_t head;
+
+    size_t count;
+} PSO_QUEUE_T;
+
+typedef struct PSO_POOL PSO_POOL_T;
+
+typedef struct
+{
+    PSO_POOL_T *pool;
+
+    size_t id;
+} PSO_WORKER_T;
+
+struct PSO_POOL
+{
+    PSO_SWARM_T *swarm;
+
+    PSO_CALLBACK_T callback;
+
+    void (*prepare)(PSO_POOL_T *pool);
+
+    void *(*work)(void *data);
+
+    size_t nthreads;
+
+    pthread_barrier_t barrier;
+
+    pthread_mutex_t mutex;
+
+    pthread_cond_t cond;
+
+    bool started;
+
+    bool aborted;
+
+    bool running;
+
+    PSO_QUEUE_T *queues;
+
+    size_t completed;
+
+    double tick_fitness;
+
+    size_t cursor;
+
+    PSO_SWARM_T *moved;
+};
+
+static void pool_prepare(PSO_POOL_T *pool)
+{
+    if (pool->callback)
+        pool->callback(pool->swarm);
+
+    pso_shuffle(pool->swarm);
+
+    pool->cursor = 0;
+}
+
+/*
+   This writes to the storage of particles [begin, end) in the arena of *moved*
+   (and to the same places in the shuffled list).
+*/
+
+static void touch(PSO_SWARM_T *moved, size_t begin, size_t end)
+{
+    size_t n = end - begin;
+
+    size_t row = moved->stride * sizeof(double);
+
+    memset(moved->x + begin * moved->stride, 0, n * row);
+    memset(moved->tmp + begin * moved->stride, 0, n * row);
+    memset(moved->v + begin * moved->stride, 0, n * row);
+    memset(moved->p + begin * moved->stride, 0, n * row);
+    memset(moved->p + (moved->size + begin) * moved->stride, 0, n * row);
+
+    double *reals[] = { moved->q, moved->m };
+
+    uint64_t *integers[] =
+    {
+        moved->indices,
+        moved->l,
+        moved->row,
+        moved->changed,
+        moved->ends,
+        moved->counts,
+        moved->order
+    };
+
+    for (size_t i = 0; i < 2; ++i)
+        memset(reals[i] + begin, 0, n * sizeof(double));
+
+    for (size_t i = 0; i < 7; ++i)
+        memset(integers[i] + begin, 0, n * sizeof(uint64_t));
+
+    if (moved->batch_pos)
+        memset(
+                moved->batch_pos + begin * moved->dim,
+                0,
+                n * moved->dim * sizeof(double)
+              );
+}
+
+/*
+   In ownership mode, the swarm moves to a fresh arena at the start of a
+   parallel run. Each thread first writes to the storage of its own blocks, so
+   that under Linux's first-touch policy those pages are placed on its NUMA
+   node, and the contents are then copied over by a single thread.
+*/
+
+static void settle(PSO_POOL_T *pool, size_t id)
+{
+    PSO_SWARM_T *swarm = pool->swarm;
+
+    for (size_t b = id; b < swarm->blocks; b += pool->nthreads)
+        touch(pool->moved, block_start(swarm, b), block_start(swarm, b + 1));
+
+    if (pthread_barrier_wait(&pool->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        memcpy(pool->moved->arena, swarm->arena, swarm->footprint);
+
+        free(swarm->arena);
+
+        carve(
+                swarm,
+                pool->moved->arena,
+                swarm->dim,
+                swarm->size,
+                swarm->batch_fitness
+             );
+    }
+
+    pthread_barrier_wait(&pool->barrier);
+}
+
+static void *pool_work(void *data)
+{
+    PSO_WORKER_T *worker = (PSO_WORKER_T *)data;
+
+    PSO_POOL_T *pool = worker->pool;
+
+    PSO_SWARM_T *swarm = pool->swarm;
+
+    STATS_ENTER(worker->id);
+
+    if (pool->moved)
+        settle(pool, worker->id);
+
+    do
+    {
+        STATS_START(w);
+
+        size_t begin;
+
+        // An owner always updates the same blocks.
+        if (swarm->blocks)
+            for (size_t b = worker->id; b < swarm->blocks; b += pool->nthreads)
+            {
+                begin = block_start(swarm, b);
+
+                size_t end = block_start(swarm, b + 1);
+
+                if (end > begin)
+                    pso_evaluate_interval(swarm, begin, end - 1);
+            }
+        else
+            while ((begin = __atomic_fetch_add(
+                            &pool->cursor,
+                            PSO_CHUNK,
+                            __ATOMIC_RELAXED
+                            )) < swarm->size)
+            {
+                size_t end = (swarm->size - begin > PSO_CHUNK) ?
+                    begin + PSO_CHUNK - 1 : swarm->size - 1;
+
+                pso_evaluate_interval(swarm, begin, end);
+            }
+
+        bool split = swarm->batch_fitness && swarm->batch_split;
+
+        // Every position must be in place before the batch is split.
+        if (split)
+        {
+            STATS_START(s);
+
+            pthread_barrier_wait(&pool->barrier);
+
+            STATS_STOP(PSO_PHASE_BARRIER, s);
+
+            if (swarm->blocks)
+                for (
+                        size_t b = worker->id;
+                        b < swarm->blocks;
+                        b += pool->nthreads
+                    )
+                    evaluate_rows(
+                            swarm,
+                            block_start(swarm, b),
+                            block_start(swarm, b + 1)
+                            );
+            else
+                evaluate_rows(
+                        swarm,
+                        worker->id * swarm->size / pool->nthreads,
+                        (worker->id + 1) * swarm->size / pool->nthreads
+                        );
+        }
+
+        STATS_START(t);
+
+        int serial = pthread_barrier_wait(&pool->barrier);
+
+        STATS_STOP(PSO_PHASE_BARRIER, t);
+
+        if (serial == PTHREAD_BARRIER_SERIAL_THREAD)
+        {
+            pool->running = finalize(swarm, split);
+
+            if (pool->running)
+                pool_prepare(pool);
+        }
+
+        STATS_START(u);
+
+        pthread_barrier_wait(&pool->barrier);
+
+        STATS_STOP(PSO_PHASE_BARRIER, u);
+        STATS_BUSY(w);
+        STATS_FLUSH(swarm);
+    } while (pool->running);
+
+    return NULL;
+}
+
+static void queue_push(PSO_QUEUE_T *queue, uint64_t index, size_t capacity)
+{
+    lock(&queue->mutex);
+
+    queue->items[(queue->head + queue->count++) % capacity] = index;
+
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static bool queue_pop(
+        PSO_QUEUE_T *queue,
+        uint64_t *index,
+        size_t capacity,
+        bool steal
+        )
+{
+    bool found = false;
+
+    lock(&queue->mutex);
+
+    if (queue->count)
+    {
+        found = true;
+
+        if (steal)
+            *index = queue->items[(queue->head + --queue->count) % capacity];
+        else
+        {
+            *index = queue->items[queue->head];
+
+            queue->head = (queue->head + 1) % capacity;
+            --queue->count;
+        }
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+
+    return found;
+}
+
+static void async_prepare(PSO_POOL_T *pool)
+{
+    pool->swarm->reason = PSO_STOP_NONE;
+
+    pso_shuffle(pool->swarm);
+
+    for (size_t i = 0; i < pool->swarm->size; ++i)
+        queue_push(
+                pool->queues + i % pool->nthreads,
+                pool->swarm->indices[i],
+                pool->swarm->size
+                );
+
+    pool->tick_fitness = pool->swarm->best_fitness;
+
+    if (pool->callback)
+        pool->callback(pool->swarm);
+}
+
+// This claims one evaluation from the budget, returning false if none are left.
+static bool claim_evaluation(PSO_SWARM_T *swarm)
+{
+    size_t left = __atomic_load_n(&swarm->max_evals, __ATOMIC_RELAXED);
+
+    do
+    {
+        if (left == 0)
+            return false;
+    } while (!__atomic_compare_exchange_n(
+                &swarm->max_evals,
+                &left,
+                left - 1,
+                true,
+                __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED
+                ));
+
+    return true;
+}
+
+/*
+   An asynchronous worker repeatedly claims an evaluation, takes a particle
+   (stealing one if its own queue is empty), moves and evaluates it, and then
+   shares the result with the neighbourhood straight away. Reading *l* and
+   broadcasting are done under the swarm mutex, since other workers may be
+   writing to the same rows. Every *size* evaluations count as an iteration for
+   the purposes of topology regeneration and the callback.
+*/
+
+static void *async_work(void *data)
+{
+    PSO_WORKER_T *worker = (PSO_WORKER_T *)data;
+
+    PSO_POOL_T *pool = worker->pool;
+
+    PSO_SWARM_T *swarm = pool->swarm;
+
+    PSO_QUEUE_T *own = pool->queues + worker->id;
+
+    STATS_ENTER(worker->id);
+
+    while (claim_evaluation(swarm))
+    {
+        STATS_START(w);
+
+        uint64_t index;
+
+        for (size_t i = 0; !queue_pop(
+                    pool->queues + (worker->id + i) % pool->nthreads,
+                    &index,
+                    swarm->size,
+                    i % pool->nthreads != 0
+                    ); ++i)
+            if (i % pool->nthreads == pool->nthreads - 1)
+                sched_yield();
+
+        double *x = swarm->x + index * swarm->stride;
+        double *tmp = swarm->tmp + index * swarm->stride;
+        double *v = swarm->v + index * swarm->stride;
+
+        lock(&swarm->mutex);
+
+        STATS_START(t);
+
+        // Personal bests are only written under the lock.
+        double *p = best_row(swarm, index);
+        double *l = (swarm->l[index] == index) ?
+            NULL : best_row(swarm, swarm->l[index]);
+
+        swarm->kernels.guide(x, p, l, tmp, swarm->c, swarm->dim);
+
+        pthread_mutex_unlock(&swarm->mutex);
+
+        swarm->kernels.move(
+                swarm->states[index],
+                x,
+                v,
+                tmp,
+                swarm->omega,
+                swarm->dim
+                );
+
+        STATS_STOP(PSO_PHASE_UPDATE, t);
+
+        double fitness = pso_compute_fitness(swarm, x, tmp, swarm->q[index]);
+
+        lock(&swarm->mutex);
+
+        if (fitness < swarm->q[index])
+        {
+            memcpy(p, x, swarm->dim * sizeof(double));
+
+            swarm->q[index] = fitness;
+
+            STATS_COUNT(improvements, 1);
+
+            if (fitness < swarm->best_fitness)
+            {
+                swarm->best_fitness = fitness;
+
+                memcpy(swarm->best_pos, p, swarm->dim * sizeof(double));
+            }
+
+            if (fitness < swarm->m[index])
+                broadcast(swarm, index);
+        }
+
+        if (++pool->completed % swarm->size == 0)
+        {
+            if (swarm->best_fitness == pool->tick_fitness)
+                regenerate_topology(swarm);
+
+            // Emptying the budget stops every worker at its next claim.
+            if (swarm->reason == PSO_STOP_NONE)
+            {
+                swarm->reason = check_termination(swarm, pool->tick_fitness);
+
+                if (swarm->reason != PSO_STOP_NONE)
+                    __atomic_store_n(&swarm->max_evals, 0, __ATOMIC_RELAXED);
+            }
+
+            pool->tick_fitness = swarm->best_fitness;
+
+            STATS_FLUSH(swarm);
+
+            if (pool->callback)
+                pool->callback(swarm);
+        }
+
+        pthread_mutex_unlock(&swarm->mutex);
+
+        queue_push(own, index, swarm->size);
+
+        STATS_BUSY(w);
+    }
+
+    STATS_FLUSH(swarm);
+
+    return NULL;
+}
+
+static void *pool_start(void *data)
+{
+    PSO_WORKER_T *worker = (PSO_WORKER_T *)data;
+
+    PSO_POOL_T *pool = worker->pool;
+
+    // Wait until every thread exists (or one of them failed to start).
+    pthread_mutex_lock(&pool->mutex);
+
+    while (!(pool->started || pool->aborted))
+        pthread_cond_wait(&pool->cond, &pool->mutex);
+
+    bool aborted = pool->aborted;
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (aborted)
+        return NULL;
+
+    return pool->work(data);
+}
+
+/*
+   This starts the pool's threads, with the calling thread acting as worker 0,
+   and waits for them to finish. Nothing is done to the swarm (and *prepare* is
+   not called) unless every thread could be created.
+*/
+
+static bool run_pool(PSO_POOL_T *pool, int *cpus)
+{
+    size_t nthreads = pool->nthreads;
+
+    PSO_WORKER_T *workers = malloc(nthreads * sizeof(PSO_WORKER_T));
+
+    if (!workers)
+        goto run_pool_error_1;
+
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+
+    if (!threads)
+        goto run_pool_error_2;
+
+    if (pthread_barrier_init(&pool->barrier, NULL, nthreads) != 0)
+        goto run_pool_error_3;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    pool->started = false;
+    pool->aborted = false;
+    pool->running = true;
+
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+
+#ifndef EXCLUDE_LINUX
+    cpu_set_t old_set;
+
+    if (cpus)
+        pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &old_set);
+#else
+    (void)cpus;
+#endif
+
+    // Thread 0 is the calling thread, so only the rest need to be created.
+    size_t created = 1;
+
+    for (size_t i = 0; i < nthreads; ++i)
+    {
+        workers[i].pool = pool;
+        workers[i].id = i;
+
+#ifndef EXCLUDE_LINUX
+        if (cpus)
+        {
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i], &set);
+
+            if (i == 0)
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            else
+                pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+#endif
+
+        if (i == 0)
+            continue;
+
+        if (pthread_create(threads + i, &attr, pool_start, workers + i) != 0)
+            break;
+
+        ++created;
+    }
+
+    pthread_attr_destroy(&attr);
+
+    // The first iteration has to be prepared before the others are let go.
+    if (created == nthreads)
+        pool->prepare(pool);
+
+    pthread_mutex_lock(&pool->mutex);
+
+    if (created == nthreads)
+        pool->started = true;
+    else
+        pool->aborted = true;
+
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (pool->started)
+        pool->work(workers);
+
+    for (size_t i = 1; i < created; ++i)
+        pthread_join(threads[i], NULL);
+
+#ifndef EXCLUDE_LINUX
+    if (cpus)
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &old_set);
+#endif
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_barrier_destroy(&pool->barrier);
+
+    free(threads);
+    free(workers);
+
+    return pool->started;
+
+run_pool_error_3:
+    free(threads);
+run_pool_error_2:
+    free(workers);
+run_pool_error_1:
+    return false;
+}
+
+static size_t clip_threads(PSO_SWARM_T *swarm, size_t nthreads)
+{
+    if (nthreads == 0)
+        return 1;
+    else if (nthreads > swarm->size)
+        return swarm->size;
+    else
+        return nthreads;
+}
+
+bool pso_run_parallel(
+        PSO_SWARM_T *swarm,
+        size_t nthreads,
+        int *cpus,
+        PSO_CALLBACK_T callback
+        )
+{
+    if (!swarm)
+        return false;
+
+    PSO_POOL_T pool =
+    {
+        .swarm = swarm,
+        .callback = callback,
+        .prepare = pool_prepare,
+        .work = pool_work,
+        .nthreads = clip_threads(swarm, nthreads)
+    };
+
+    PSO_SWARM_T moved;
+
+    void *arena = NULL;
+
+    // The move is only an optimization, so a failed allocation is no error.
+    if (
+            swarm->blocks &&
+            posix_memalign(&arena, PSO_ALIGNMENT, swarm->footprint) == 0
+       )
+    {
+        moved = *swarm;
+
+        carve(&moved, arena, swarm->dim, swarm->size, swarm->batch_fitness);
+
+        pool.moved = &moved;
+    }
+
+    bool started = run_pool(&pool, cpus);
+
+    // The new arena is taken up as soon as the threads have started.
+    if (!started)
+        free(arena);
+
+    return started;
+}
+
+bool pso_run_async(
+        PSO_SWARM_T *swarm,
+        size_t nthreads,
+        int *cpus,
+        PSO_CALLBACK_T callback
+        )
+{
+    if (!swarm || swarm->batch_fitness)
+        goto pso_run_async_error_1;
+
+    nthreads = clip_threads(swarm, nthreads);
+
+    PSO_POOL_T pool =
+    {
+        .swarm = swarm,
+        .callback = callback,
+        .prepare = async_prepare,
+        .work = async_work,
+        .nthreads = nthreads,
+        .completed = 0
+    };
+
+    pool.queues = malloc(nthreads * sizeof(PSO_QUEUE_T));
+
+    if (!pool.queues)
+        goto pso_run_async_error_1;
+
+    uint64_t *items = malloc(nthreads * swarm->size * sizeof(uint64_t));
+
+    if (!items)
+        goto pso_run_async_error_2;
+
+    for (size_t i = 0; i < nthreads; ++i)
+    {
+        PSO_QUEUE_T *queue = pool.queues + i;
+
+        pthread_mutex_init(&queue->mutex, NULL);
+
+        queue->items = items + i * swarm->size;
+        queue->head = 0;
+        queue->count = 0;
+    }
+
+    bool success = run_pool(&pool, cpus);
+
+    if (success && swarm->reason == PSO_STOP_NONE)
+        swarm->reason = PSO_STOP_BUDGET;
+
+    for (size_t i = 0; i < nthreads; ++i)
+        pthread_mutex_destroy(&pool.queues[i].mutex);
+
+    free(items);
+    free(pool.queues);
+
+    return success;
+
+pso_run_async_error_2:
+    free(pool.queues);
+pso_run_async_error_1:
+    return false;
+}
+
+/*
+   A checkpoint image starts with a fixed header, followed by the transform
+   parameters, the best position, the indices, the links of the topology, the
+   x, v and p rows (*dim* doubles each, without padding), the q, m and l
+   vectors and finally the saved RNG states of the swarm and of each particle.
+   Everything is stored in native byte order. The header also carries the
+   stopping rules and their progress, with the time spent under a time limit
+   kept as *elapsed* seconds, as well as the restart policy and the number of
+   restarts so far.
+*/
+
+#define PSO_CHECKPOINT_MAGIC "PSOCKPT"
+#define PSO_CHECKPOINT_VERSION 6
+
+typedef struct
+{
+    char magic[8];
+
+    uint64_t version;
+
+    char uid[64];
+
+    uint64_t rng_size;
+
+    uint64_t dim;
+
+    uint64_t size;
+
+    uint64_t k;
+
+    uint64_t topology;
+
+    uint64_t blocks;
+
+    uint64_t max_evals;
+
+    double c;
+
+    double omega;
+
+    double best_fitness;
+
+    PSO_TERMINATION_T termination;
+
+    uint64_t iteration;
+
+    uint64_t last_improvement;
+
+    uint64_t window_start;
+
+    double window_fitness;
+
+    double elapsed;
+
+    PSO_RESTART_T restart;
+
+    uint64_t restarts;
+} PSO_CHECKPOINT_T;
+
+// These functions transfer an array, recording the first failure in *ok*.
+
+static void put(FILE *file, void *data, size_t len, bool *ok)
+{
+    if (*ok && len && fwrite(data, len, 1, file) != 1)
+        *ok = false;
+}
+
+static void get(FILE *file, void *data, size_t len, bool *ok)
+{
+    if (*ok && len && fread(data, len, 1, file) != 1)
+        *ok = false;
+}
+
+// Row i of the image is row *rows*[i] of the matrix, or row i if it's NULL.
+static void transfer_rows(
+        FILE *file,
+        PSO_SWARM_T *swarm,
+        double *matrix,
+        uint64_t *rows,
+        bool writing,
+        bool *ok
+        )
+{
+    size_t len = swarm->dim * sizeof(double);
+
+    for (size_t i = 0; i < swarm->size; ++i)
+    {
+        double *row = matrix + (rows ? rows[i] : i) * swarm->stride;
+
+        if (writing)
+            put(file, row, len, ok);
+        else
+            get(file, row, len, ok);
+    }
+}
+
+/*
+   The body of the image is symmetric, so the same function reads and writes
+   it. The RNG states go through a buffer of *rng_state_size()* bytes.
+*/
+
+static bool transfer_body(
+        FILE *file,
+        PSO_SWARM_T *swarm,
+        unsigned char *buf,
+        bool writing
+        )
+{
+    void (*move_data)(FILE *, void *, size_t, bool *) = writing ? put : get;
+
+    size_t vector = swarm->dim * sizeof(double);
+
+    size_t rng_size = rng_state_size();
+
+    bool ok = true;
+
+    move_data(file, swarm->lower, vector, &ok);
+    move_data(file, swarm->coefs, vector, &ok);
+    move_data(file, swarm->best_pos, vector, &ok);
+
+    move_data(file, swarm->indices, swarm->size * sizeof(uint64_t), &ok);
+
+    move_data(
+            file,
+            swarm->topology.links,
+            swarm->topology.offsets[swarm->size] * sizeof(uint64_t),
+            &ok
+            );
+
+    transfer_rows(file, swarm, swarm->x, NULL, writing, &ok);
+    transfer_rows(file, swarm, swarm->v, NULL, writing, &ok);
+    transfer_rows(file, swarm, swarm->p, swarm->row, writing, &ok);
+
+    move_data(file, swarm->q, swarm->size * sizeof(double), &ok);
+    move_data(file, swarm->m, swarm->size * sizeof(double), &ok);
+    move_data(file, swarm->l, swarm->size * sizeof(uint64_t), &ok);
+
+    for (size_t i = 0; i <= swarm->size; ++i)
+    {
+        RNG_STATE_T state = (i == 0) ? swarm->state : swarm->states[i - 1];
+
+        if (writing)
+            rng_save_state(state, buf);
+
+        move_data(file, buf, rng_size, &ok);
+
+        if (!writing && ok)
+            rng_load_state(state, buf);
+    }
+
+    return ok;
+}
+
+bool pso_checkpoint(PSO_SWARM_T *swarm, char *path)
+{
+    if (!(swarm && path))
+        goto pso_checkpoint_error_1;
+
+    size_t path_len = strlen(path);
+
+    char *tmp_path = malloc(path_len + 5);
+
+    if (!tmp_path)
+        goto pso_checkpoint_error_1;
+
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+
+    unsigned char *buf = malloc(rng_state_size() + 1);
+
+    if (!buf)
+        goto pso_checkpoint_error_2;
+
+    FILE *file = fopen(tmp_path, "wb");
+
+    if (!file)
+        goto pso_checkpoint_error_3;
+
+    PSO_CHECKPOINT_T header =
+    {
+        .magic = PSO_CHECKPOINT_MAGIC,
+        .version = PSO_CHECKPOINT_VERSION,
+        .rng_size = rng_state_size(),
+        .dim = swarm->dim,
+        .size = swarm->size,
+        .k = swarm->k,
+        .topology = swarm->topology.kind,
+        .blocks = swarm->blocks,
+        .max_evals = swarm->max_evals,
+        .c = swarm->c,
+        .omega = swarm->omega,
+        .best_fitness = swarm->best_fitness,
+        .termination = swarm->termination,
+        .iteration = swarm->iteration,
+        .last_improvement = swarm->last_improvement,
+        .window_start = swarm->window_start,
+        .window_fitness = swarm->window_fitness,
+        .elapsed = swarm->termination.time_limit > 0 ?
+            wall_clock() - swarm->started : 0,
+        .restart = swarm->restart,
+        .restarts = swarm->restarts
+    };
+
+    strncpy(header.uid, rng_uid(), sizeof(header.uid) - 1);
+
+    bool ok = true;
+
+    put(file, &header, sizeof(header), &ok);
+
+    ok = ok && transfer_body(file, swarm, buf, true);
+
+    // Make sure the data is on disk before the rename makes it visible.
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+
+    if (fclose(file) != 0 || !ok || rename(tmp_path, path) != 0)
+        goto pso_checkpoint_error_4;
+
+    free(buf);
+    free(tmp_path);
+
+    return true;
+
+pso_checkpoint_error_4:
+    remove(tmp_path);
+pso_checkpoint_error_3:
+    free(buf);
+pso_checkpoint_error_2:
+    free(tmp_path);
+pso_checkpoint_error_1:
+    return false;
+}
+
+bool pso_restore(PSO_SWARM_T *swarm, char *path, PSO_FITNESS_T fitness)
+{
+    if (!(swarm && path && fitness))
+        goto pso_restore_error_1;
+
+    FILE *file = fopen(path, "rb");
+
+    if (!file)
+        goto pso_restore_error_1;
+
+    PSO_CHECKPOINT_T header;
+
+    bool ok = true;
+
+    get(file, &header, sizeof(header), &ok);
+
+    // The image has to come from this version and this generator.
+    if (
+            !ok ||
+            memcmp(header.magic, PSO_CHECKPOINT_MAGIC, 8) != 0 ||
+            header.version != PSO_CHECKPOINT_VERSION ||
+            header.rng_size != rng_state_size() ||
+            strncmp(header.uid, rng_uid(), sizeof(header.uid)) != 0 ||
+            !(header.dim && header.size && header.k) ||
+            header.blocks > header.size
+       )
+        goto pso_restore_error_2;
+
+    unsigned char *buf = malloc(rng_state_size() + 1);
+
+    if (!buf)
+        goto pso_restore_error_2;
+
+    swarm->state = rng_allocate_state();
+
+    if (!swarm->state)
+        goto pso_restore_error_3;
+
+    if (!allocate(swarm, header.dim, header.size, false))
+        goto pso_restore_error_4;
+
+    if (!topology_initialize(
+                &swarm->topology,
+                header.topology,
+                header.size,
+                header.k
+                ))
+        goto pso_restore_error_5;
+
+    swarm->states = malloc(header.size * sizeof(RNG_STATE_T));
+
+    if (!swarm->states)
+        goto pso_restore_error_6;
+
+    size_t num_states = 0;
+
+    for (; num_states < header.size; ++num_states)
+    {
+        swarm->states[num_states] = rng_allocate_state();
+
+        if (!swarm->states[num_states])
+            goto pso_restore_error_7;
+    }
+
+    swarm->fitness = fitness;
+    swarm->batch_fitness = NULL;
+    swarm->batch_split = false;
+    swarm->ctx = NULL;
+    swarm->cache = NULL;
+    memset(&swarm->stats, 0, sizeof(PSO_STATS_T));
+    swarm->termination = header.termination;
+    swarm->reason = PSO_STOP_NONE;
+    swarm->iteration = header.iteration;
+    swarm->last_improvement = header.last_improvement;
+    swarm->window_start = header.window_start;
+    swarm->window_fitness = header.window_fitness;
+    swarm->started = header.termination.time_limit > 0 ?
+        wall_clock() - header.elapsed : 0;
+    swarm->restart = header.restart;
+    swarm->restarts = header.restarts;
+    swarm->dim = header.dim;
+    swarm->size = header.size;
+    swarm->k = header.k;
+    swarm->blocks = header.blocks;
+    swarm->max_evals = header.max_evals;
+    swarm->c = header.c;
+    swarm->omega = header.omega;
+    swarm->best_fitness = header.best_fitness;
+
+    if (!transfer_body(file, swarm, buf, false))
+        goto pso_restore_error_7;
+
+    pthread_mutex_init(&swarm->mutex, NULL);
+
+    free(buf);
+    fclose(file);
+
+    return true;
+
+pso_restore_error_7:
+    for (size_t i = 0; i < num_states; ++i)
+        rng_free_state(swarm->states[i]);
+
+    free(swarm->states);
+pso_restore_error_6:
+    topology_free(&swarm->topology);
+pso_restore_error_5:
+    free(swarm->arena);
+pso_restore_error_4:
+    rng_free_state(swarm->state);
+pso_restore_error_3:
+    free(buf);
+pso_restore_error_2:
+    fclose(file);
+pso_restore_error_1:
+    return false;
+}
+
+bool pso_get_stats(PSO_SWARM_T *swarm, PSO_STATS_T *stats)
+{
+#ifdef PSO_STATS
+    uint64_t *src = (uint64_t *)&swarm->stats;
+    uint64_t *dst = (uint64_t *)stats;
+
+    for (size_t i = 0; i < sizeof(PSO_STATS_T) / sizeof(uint64_t); ++i)
+        dst[i] = __atomic_load_n(src + i, __ATOMIC_RELAXED);
+
+    return true;
+#else
+    (void)swarm;
+
+    memset(stats, 0, sizeof(PSO_STATS_T));
+
+    return false;
+#endif
+}
+
+static char *phase_names[PSO_PHASES] =
+{
+    "shuffle",
+    "update",
+    "hypersphere",
+    "fitness",
+    "finalize",
+    "broadcast",
+    "topology",
+    "lock",
+    "barrier"
+};
+
+bool pso_write_stats(PSO_STATS_T *stats, FILE *file)
+{
+    bool ok = fputs("name,count,seconds\n", file) >= 0;
+
+    for (unsigned i = 0; i < PSO_PHASES; ++i)
+        ok = ok && fprintf(
+                file,
+                "%s,%" PRIu64 ",%.9f\n",
+                phase_names[i],
+                stats->calls[i],
+                1e-9 * stats->nanoseconds[i]
+                ) >= 0;
+
+    ok = ok && fprintf(
+            file,
+            "evaluations,%" PRIu64 ",\n"
+            "improvements,%" PRIu64 ",\n"
+            "regenerations,%" PRIu64 ",\n",
+            stats->evaluations,
+            stats->improvements,
+            stats->regenerations
+            ) >= 0;
+
+    // Buckets are named after their lower bound in nanoseconds.
+    for (unsigned i = 0; i < PSO_STATS_BUCKETS; ++i)
+        ok = ok && fprintf(
+                file,
+                "latency_%" PRIu64 "ns,%" PRIu64 ",\n",
+                (uint64_t)1 << i,
+                stats->latency[i]
+                ) >= 0;
+
+    // Only the workers which did something are listed.
+    for (unsigned i = 0; i < PSO_STATS_THREADS; ++i)
+        if (stats->busy[i] || stats->idle[i])
+            ok = ok && fprintf(
+                    file,
+                    "busy_%u,,%.9f\n"
+                    "idle_%u,,%.9f\n",
+                    i,
+                    1e-9 * stats->busy[i],
+                    i,
+                    1e-9 * stats->idle[i]
+                    ) >= 0;
+
+    return ok;
+}
+
+void pso_write_position(PSO_SWARM_T *swarm, double *pos)
+{
+    util_list_map(
+            swarm->best_pos,
+            pos,
+            swarm->coefs,
+            swarm->lower,
+            swarm->dim
+            );
+}
+
+void pso_write_optimum(PSO_SWARM_T *swarm, PSO_RESULTS_T *results)
+{
+    if (swarm->dim <= PSO_RESULTS_MAX_DIM)
+        pso_write_position(swarm, results->pos);
+
+    results->fitness = swarm->best_fitness;
+    results->reason = swarm->reason;
+}
+
+void pso_free(PSO_SWARM_T *swarm)
+{
+    for (size_t i = 0; i < swarm->size; ++i)
+        rng_free_state(swarm->states[i]);
+
+    free(swarm->states);
+
+    rng_free_state(swarm->state);
+
+    pthread_mutex_destroy(&swarm->mutex);
+
+    if (swarm->cache)
+    {
+        cache_free(swarm->cache);
+
+        free(swarm->cache);
+    }
+
+    topology_free(&swarm->topology);
+
+    free(swarm->arena);
 }
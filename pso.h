@@ -4,7 +4,12 @@
 // This file provides definitions for the main PSO algorithm.
 
 #include <stdbool.h>
+#include <stdio.h>
 
+#include <pthread.h>
+
+#include "cache.h"
+#include "topology.h"
 #include "transform.h"
 
 /*
@@ -16,75 +21,414 @@
 #define PSO_MAX_NEIGHBORS 25
 #endif
 
-// This constant defines the maximum PSO swarm size.
+/*
+   This constant defines the alignment (in bytes) of every array held by the
+   swarm. It should be a power of two, a multiple of sizeof(double) and at
+   least the size of a cache line.
+*/
 
-#ifndef PSO_MAX_SWARM_SIZE
-#define PSO_MAX_SWARM_SIZE 50
+#ifndef PSO_ALIGNMENT
+#define PSO_ALIGNMENT 64
 #endif
 
-// This definition is for the fitness function that will be supplied to PSO.
+/*
+   This constant defines the largest dimension for which specialized kernels
+   are built (see PSO_KERNELS_T). Defining EXCLUDE_KERNELS leaves only the
+   generic ones.
+*/
+
+#define PSO_KERNEL_MAX_DIM 16
+
+/*
+   This constant defines the number of shuffled particles the threads of
+   *pso_run_parallel()* claim at a time. Claiming them one by one balances the
+   load best when fitness evaluations vary in cost; a larger chunk cuts the
+   contention on the shared cursor when they are cheap.
+*/
+
+#ifndef PSO_CHUNK
+#define PSO_CHUNK 1
+#endif
+
+/*
+   This definition is for the fitness function that will be supplied to PSO.
+   Besides the position, it receives an upper bound: the fitness of the
+   evaluating particle's personal best (or INFINITY if there is none yet). As
+   PSO only needs to know whether the result beats the bound, the function may
+   give up as soon as it can tell that it won't, and return any value which is
+   not lower than *bound*. Fitness functions written for the older form, which
+   only took the position, need the extra parameter (they may ignore it).
+*/
+
+typedef double (*PSO_FITNESS_T)(double *pos, double bound);
+
+/*
+   This definition is for the alternative batch fitness function. It receives
+   the positions of *n* particles as a row-major *n* x *dim* matrix (already
+   mapped from the unit hypercube to the search space) and should write the *n*
+   fitness values to *out*. Each row comes with a bound in *bounds*, which
+   plays the same part as for PSO_FITNESS_T, so the evaluation of a row may
+   stop early and report any value at least as large as its bound. A NULL
+   *bounds* means there are none. The pointer *ctx* is passed through
+   untouched.
+*/
+
+typedef void (*PSO_BATCH_FITNESS_T)(
+        const double *positions,
+        const double *bounds,
+        size_t n,
+        size_t dim,
+        double *out,
+        void *ctx
+        );
+
+/*
+   These are the kernels doing the per-particle work of an iteration on rows of
+   the swarm matrices. The first one writes the center of the sampling
+   hypersphere to *tmp*, from the position *x*, the personal best *p* and the
+   best position *l* heard from the neighbourhood (NULL if the particle knows
+   of nothing better than its own). The second one samples the
+   hypersphere with the particle's *state*, then updates the velocity *v* and
+   the position. The third one maps a position from the unit hypercube to the
+   search space, as *util_list_map()* does. Besides generic versions which loop
+   to the runtime dimension *dim*, there are versions built for each dimension
+   from 2 to PSO_KERNEL_MAX_DIM, whose loops have constant trip counts and are
+   fully unrolled (they ignore *dim*). *pso_initialize()* picks the specialized
+   kernels whenever they exist for the requested dimension.
+*/
+
+typedef struct
+{
+    void (*guide)(
+            double *x,
+            double *p,
+            double *l,
+            double *tmp,
+            double c,
+            size_t dim
+            );
+
+    void (*move)(
+            RNG_STATE_T state,
+            double *x,
+            double *v,
+            double *tmp,
+            double omega,
+            size_t dim
+            );
+
+    void (*map)(double *in, double *out, double *m, double *b, size_t dim);
+} PSO_KERNELS_T;
+
+/*
+   These are the reasons for which a run can stop. PSO_STOP_NONE means that the
+   swarm is still running (or hasn't been run yet).
+*/
+
+typedef enum
+{
+    PSO_STOP_NONE,
+    PSO_STOP_BUDGET,
+    PSO_STOP_TARGET,
+    PSO_STOP_STAGNATION,
+    PSO_STOP_TOLERANCE,
+    PSO_STOP_DIAMETER,
+    PSO_STOP_DEADLINE
+} PSO_STOP_T;
+
+/*
+   These are the stopping rules checked besides the evaluation budget, where a
+   zero value turns a rule off. The run stops once:
+
+   - the best fitness is at most *target* (if *has_target* is set),
+   - the best fitness hasn't improved for *stagnation* iterations,
+   - the best fitness has improved by no more than *abs_tolerance* plus
+     *rel_tolerance* times its magnitude over the last *window* iterations,
+   - the personal bests span less than *diameter* along every axis of the unit
+     hypercube, or
+   - *time_limit* seconds have passed since the rules were set.
+*/
+
+typedef struct
+{
+    bool has_target;
+
+    double target;
 
-typedef double (*PSO_FITNESS_T)(double *pos);
+    size_t stagnation;
+
+    size_t window;
+
+    double abs_tolerance;
+
+    double rel_tolerance;
+
+    double diameter;
+
+    double time_limit;
+} PSO_TERMINATION_T;
+
+/*
+   This is the restart policy. Once the personal bests span less than
+   *diameter* along every axis of the unit hypercube, or the best fitness
+   hasn't improved for *stagnation* iterations, every particle but the one
+   holding the global best is placed anew by Latin Hypercube Sampling, and the
+   swarm size is multiplied by *growth* (rounding up, and never beyond
+   *max_size*). A zero value turns either trigger off, and a *growth* of at
+   most 1 keeps the size fixed.
+*/
 
 typedef struct
 {
-    double pos[TRANSFORM_MAX_DIM];
+    double diameter;
+
+    size_t stagnation;
+
+    double growth;
+
+    size_t max_size;
+} PSO_RESTART_T;
+
+/*
+   This constant defines how many coordinates of the best position fit in
+   PSO_RESULTS_T itself.
+*/
+
+#ifndef PSO_RESULTS_MAX_DIM
+#define PSO_RESULTS_MAX_DIM 50
+#endif
+
+/*
+   As before, the results hold the best position in *pos*, whenever the
+   dimension of the swarm is at most PSO_RESULTS_MAX_DIM. The best position of
+   a swarm of any dimension can be written to storage of the caller's own by
+   *pso_write_position()* instead. The *reason* field tells which rule stopped
+   the run.
+*/
+
+typedef struct
+{
+    double pos[PSO_RESULTS_MAX_DIM];
 
     double fitness;
+
+    PSO_STOP_T reason;
 } PSO_RESULTS_T;
 
+/*
+   These are the phases of the algorithm timed by the instrumentation. The
+   update phase covers the whole movement of a particle, including sampling the
+   hypersphere, and the finalize phase includes the broadcasts and topology
+   regenerations (and, in batch mode, the fitness evaluations) made from
+   *pso_finalize()*. Time spent waiting for a mutex is counted as lock time and
+   time spent waiting at the barrier of *pso_run_parallel()* as barrier time.
+*/
+
+typedef enum
+{
+    PSO_PHASE_SHUFFLE,
+    PSO_PHASE_UPDATE,
+    PSO_PHASE_HYPERSPHERE,
+    PSO_PHASE_FITNESS,
+    PSO_PHASE_FINALIZE,
+    PSO_PHASE_BROADCAST,
+    PSO_PHASE_TOPOLOGY,
+    PSO_PHASE_LOCK,
+    PSO_PHASE_BARRIER,
+    PSO_PHASES
+} PSO_PHASE_T;
+
+/*
+   This constant defines the number of buckets in the fitness latency
+   histogram. Bucket i counts the fitness calls which took between 2^i and
+   2^(i + 1) nanoseconds, and the last bucket also counts any slower ones.
+*/
+
+#ifndef PSO_STATS_BUCKETS
+#define PSO_STATS_BUCKETS 40
+#endif
+
+/*
+   This constant defines the number of workers whose busy and idle times are
+   kept apart. Workers are numbered from 0 as in *pso_run_parallel()*, and the
+   last slot also counts any further ones.
+*/
+
+#ifndef PSO_STATS_THREADS
+#define PSO_STATS_THREADS 64
+#endif
+
+/*
+   When the library is compiled with -DPSO_STATS, each thread accumulates these
+   statistics privately and adds them to the swarm's totals at the end of every
+   call to *pso_shuffle()*, *pso_evaluate_interval()* and *pso_finalize()* (and
+   periodically in asynchronous mode). Otherwise the instrumentation is compiled
+   out entirely. Times are in nanoseconds of the monotonic clock. A batch of
+   fitness evaluations counts as a single fitness call, and *regenerations*
+   doesn't count the initial topology. The idle time of a worker is its lock
+   and barrier time, and its busy time is the rest of its time in the loop of
+   *pso_run_parallel()* or *pso_run_async()*.
+*/
+
 typedef struct
 {
-    double x[TRANSFORM_MAX_DIM];
+    uint64_t nanoseconds[PSO_PHASES];
 
-    double tmp[TRANSFORM_MAX_DIM];
+    uint64_t calls[PSO_PHASES];
 
-    double v[TRANSFORM_MAX_DIM];
+    uint64_t evaluations;
 
-    double p[TRANSFORM_MAX_DIM];
+    uint64_t improvements;
 
-    double q;
+    uint64_t regenerations;
 
-    uint64_t N[PSO_MAX_NEIGHBORS + 1];
+    uint64_t latency[PSO_STATS_BUCKETS];
 
-    double l[TRANSFORM_MAX_DIM];
+    uint64_t busy[PSO_STATS_THREADS];
 
-    double m;
-} PSO_PARTICLE_T;
+    uint64_t idle[PSO_STATS_THREADS];
+} PSO_STATS_T;
+
+/*
+   The swarm is laid out as a structure of arrays sized to the actual problem.
+   The particle matrices *x* (position), *tmp* (scratch) and *v* (velocity)
+   hold one row of *stride* doubles per particle, where *stride* is the
+   dimension rounded up to a whole number of PSO_ALIGNMENT blocks. The personal
+   bests *p* have two rows per particle, and *row*[i] is the one currently
+   published for particle i (see *pso_personal_best()*). New personal bests
+   found by *pso_evaluate_interval()* go to the other row, which
+   *pso_finalize()* then publishes, so that neighbours reading a particle's
+   personal best never race with its update. The vector *q* holds the fitness
+   values of the personal bests. Rather than a copy of the best position heard
+   from the neighbourhood, each particle keeps in *l* the index of the particle
+   whose personal best it is, with its fitness at the time in *m*, so that
+   sharing an improvement costs one index update per neighbour. The particles
+   each particle informs are listed in *topology* (see topology.h).
+   Each call to *pso_evaluate_interval()* on [begin, end] records the place of
+   every particle in the shuffled list in *order*, lists the places of those
+   with news to share in *changed*[begin..], and stores end + 1 and the length
+   of the list in *ends*[begin] and *counts*[begin]. *pso_finalize()* merges
+   these partial results interval by interval into the bitmap *pending*, and
+   only visits the marked places instead of scanning the whole swarm.
+   Each particle owns an independent substream of the swarm's generator in
+   *states*, split off with *rng_jump()*, so that updates never touch shared
+   RNG state. The sequence of draws for a particle therefore doesn't depend on
+   which thread happens to update it. All the arrays share one block of
+   *footprint* bytes at *arena*, and *blocks* is the number of ownership blocks
+   (see *pso_set_ownership()*), or 0.
+*/
 
 typedef struct
 {
     RNG_STATE_T state;
 
+    RNG_STATE_T *states;
+
     pthread_mutex_t mutex;
 
     PSO_FITNESS_T fitness;
 
+    PSO_BATCH_FITNESS_T batch_fitness;
+
+    void *ctx;
+
     size_t dim;
 
+    size_t stride;
+
     size_t size;
 
     size_t max_evals;
 
     size_t k;
 
+    PSO_KERNELS_T kernels;
+
     double best_fitness;
 
     double omega;
 
     double c;
 
-    PSO_PARTICLE_T particles[PSO_MAX_SWARM_SIZE];
+    void *arena;
+
+    size_t footprint;
+
+    size_t blocks;
+
+    double *x;
+
+    double *tmp;
+
+    double *v;
+
+    double *p;
+
+    double *q;
+
+    double *m;
+
+    uint64_t *l;
+
+    uint64_t *row;
+
+    uint64_t *changed;
+
+    uint64_t *ends;
+
+    uint64_t *counts;
+
+    uint64_t *order;
+
+    uint64_t *pending;
 
-    uint64_t indices[PSO_MAX_SWARM_SIZE];
+    TOPOLOGY_T topology;
 
-    double lower[TRANSFORM_MAX_DIM];
+    uint64_t *indices;
 
-    double coefs[TRANSFORM_MAX_DIM];
+    double *lower;
 
-    double best_pos[TRANSFORM_MAX_DIM];
+    double *coefs;
+
+    double *best_pos;
+
+    double *batch_pos;
+
+    double *batch_out;
+
+    bool batch_split;
+
+    CACHE_T *cache;
+
+    PSO_STATS_T stats;
+
+    PSO_TERMINATION_T termination;
+
+    PSO_STOP_T reason;
+
+    size_t iteration;
+
+    size_t last_improvement;
+
+    size_t window_start;
+
+    double window_fitness;
+
+    double started;
+
+    PSO_RESTART_T restart;
+
+    size_t restarts;
 } PSO_SWARM_T;
 
+/*
+   This definition is for an optional callback which the parallel driver
+   invokes from a single thread before each iteration, while no evaluations are
+   in progress. It is mainly useful for reporting progress.
+*/
+
+typedef void (*PSO_CALLBACK_T)(PSO_SWARM_T *swarm);
+
 /*
    This function initializes the structure that keeps track of the PSO swarm.
    It should be provided a pointer to the swarm, the fitness function, the
@@ -108,14 +452,162 @@ bool pso_initialize(
         char *phrase
         );
 
+/*
+   This function is the batch mode counterpart of *pso_initialize()*. The swarm
+   will evaluate every particle of an iteration with a single call to
+   *batch_fitness* (with *ctx* as its last argument), which takes place in
+   *pso_finalize()*. The intervals then only move the particles and map their
+   positions to the search space. Each particle's bound is its personal best,
+   except when the swarm is seeded.
+*/
+
+bool pso_initialize_batch(
+        PSO_SWARM_T *swarm,
+        PSO_BATCH_FITNESS_T batch_fitness,
+        void *ctx,
+        double c,
+        double omega,
+        double *lower,
+        double *upper,
+        size_t dim,
+        size_t size,
+        size_t max_evals,
+        size_t k,
+        char *phrase
+        );
+
 /*
    This function computes the fitness of a given position within the hypercube
    by applying the appropriate affine transform before sending the coordinates
    to the fitness function. It uses *tmp* for temporary storage, and both
-   arrays should be large enough to hold *swarm*->dim doubles.
+   arrays should be large enough to hold *swarm*->dim doubles. The *bound* is
+   passed on to the fitness function. In batch mode, the position is sent as a
+   batch of one with the bound.
+*/
+
+double pso_compute_fitness(
+        PSO_SWARM_T *swarm,
+        double *pos,
+        double *tmp,
+        double bound
+        );
+
+/*
+   This function returns the published personal best of particle *i* (in the
+   unit hypercube), whose fitness is *swarm*->q[i]. Between iterations, it may
+   be overwritten together with the fitness value, and the next call to
+   *pso_finalize()* then takes the change into account.
+*/
+
+double *pso_personal_best(PSO_SWARM_T *swarm, size_t i);
+
+/*
+   This function turns on memoization of fitness values for the swarm. Cells
+   of side length *step* in the unit hypercube share a single fitness value,
+   and at most *capacity* cells are remembered. Lookups happen in
+   *pso_compute_fitness()* before the fitness function is called, so this has
+   no effect in batch mode. It returns false on invalid parameters or a memory
+   allocation error, in which case the swarm runs without a cache.
+*/
+
+bool pso_enable_cache(PSO_SWARM_T *swarm, size_t capacity, double step);
+
+/*
+   This function writes the number of cache hits and misses so far to *hits*
+   and *misses*. Both are zero if the cache isn't enabled.
+*/
+
+void pso_cache_stats(PSO_SWARM_T *swarm, uint64_t *hits, uint64_t *misses);
+
+/*
+   This function copies the statistics gathered so far to *stats*. It returns
+   false (and zeroes *stats*) if the library was compiled without -DPSO_STATS.
+   The totals only include work from calls which have completed, so a call
+   from the callback of a parallel driver sees all but the running iteration.
+*/
+
+bool pso_get_stats(PSO_SWARM_T *swarm, PSO_STATS_T *stats);
+
+/*
+   This function writes *stats* to *file* as CSV, with one row per phase, per
+   counter and per histogram bucket. Each row gives a name, a count and a time
+   in seconds (empty for counters). It returns false on a write error.
+*/
+
+bool pso_write_stats(PSO_STATS_T *stats, FILE *file);
+
+/*
+   This function sets the stopping rules of the swarm (see PSO_TERMINATION_T),
+   which are checked at the end of every *pso_finalize()* and, in asynchronous
+   mode, after every *swarm*->size evaluations. The stagnation, tolerance and
+   time limit rules count from the moment of the call. All rules are off after
+   *pso_initialize()*, leaving only the budget. A checkpoint keeps the rules
+   and how far each has got, so a swarm from *pso_restore()* stops when the
+   uninterrupted run would have (calling this function again on it would start
+   the counts over).
+*/
+
+void pso_set_termination(PSO_SWARM_T *swarm, PSO_TERMINATION_T *termination);
+
+/*
+   This function sets the restart policy of the swarm (see PSO_RESTART_T). The
+   check takes place in *pso_finalize()*, ahead of the stopping rules, so it
+   doesn't apply in asynchronous mode. The new particles are evaluated from the
+   calling thread and charged to the budget, and a restart is skipped if the
+   budget can't cover them. If a larger swarm can't be allocated, the restart
+   goes ahead at the current size. The number of restarts so far is kept in
+   *swarm*->restarts. Since the size may change between iterations, drivers
+   other than the built-in ones should partition *swarm*->size afresh every
+   iteration. Restarts are off after *pso_initialize()*, while *pso_restore()*
+   brings back the policy and the count of the checkpointed swarm.
 */
 
-double pso_compute_fitness(PSO_SWARM_T *swarm, double *pos, double *tmp);
+void pso_set_restart(PSO_SWARM_T *swarm, PSO_RESTART_T *restart);
+
+/*
+   This function replaces the topology of the swarm (TOPOLOGY_ADAPTIVE by
+   default) with one of the given *kind*, built for the swarm's size and K,
+   and lets the particles share their personal bests over it from scratch.
+   Restarts and checkpoints keep the kind of topology. It returns false,
+   leaving the topology as it was, on invalid parameters or a memory
+   allocation error.
+*/
+
+bool pso_set_topology(PSO_SWARM_T *swarm, TOPOLOGY_KIND_T kind);
+
+/*
+   This function splits the swarm into *blocks* contiguous blocks of particles,
+   each of which *pso_shuffle()* then shuffles on its own instead of mixing the
+   whole swarm. In *pso_run_parallel()*, thread i owns blocks i, i + nthreads,
+   i + 2 * nthreads and so on for the whole run, so the threads write to
+   disjoint ranges of the particle storage rather than interleaving on the
+   same cache lines. The storage is also moved to a fresh arena when the run
+   starts, with each thread touching its own blocks first so that they land on
+   its NUMA node (which is most useful with pinned threads); a swarm which
+   grows on a restart goes back to a single node. Setting *blocks* to the
+   number of threads is the natural choice, but the results depend only on
+   the number of blocks. A *blocks* of 0 (the default) restores the shuffle of
+   the whole swarm. Asynchronous mode ignores the blocks. It returns false if
+   *blocks* exceeds the swarm size.
+*/
+
+bool pso_set_ownership(PSO_SWARM_T *swarm, size_t blocks);
+
+/*
+   This function declares whether the batch fitness function of the swarm can
+   be called from several threads at once (it is assumed not to be after
+   *pso_initialize_batch()*). If it can, *pso_run_parallel()* has every thread
+   evaluate a contiguous share of the swarm (or, with ownership blocks, its own
+   blocks) once the intervals are done, rather than leaving the whole batch to
+   the serial thread in *pso_finalize()*. The results are the same either way
+   as long as the fitness of a row doesn't depend on the rest of the batch.
+*/
+
+void pso_set_batch_split(PSO_SWARM_T *swarm, bool split);
+
+// This function returns a short name for a stopping reason.
+
+char *pso_stop_name(PSO_STOP_T reason);
 
 /*
    This function shuffles the list of particles in the swarm. It should be
@@ -128,26 +620,108 @@ void pso_shuffle(PSO_SWARM_T *swarm);
    This function performs the intermediate evaluation steps on particles with
    indices in the interval [*begin*, *end*]. If the fitness function is
    thread-safe and this function is called on disjoint intervals, then it is
-   thread-safe too. It is where the bulk of the work takes place.
+   thread-safe too. It is where the bulk of the work takes place. Since each
+   particle draws from its own RNG stream, and the changes are merged in order
+   of position by *pso_finalize()*, the results don't depend on how the swarm
+   is partitioned. The intervals of an iteration should cover the whole swarm.
 */
 
 void pso_evaluate_interval(PSO_SWARM_T *swarm, size_t begin, size_t end);
 
 /*
    This function shoud be called after each interval in a partition of the
-   swarm has been evaluated. It returns true if the swarm is ready for another
-   iteration and false if the computation has terminated.
+   swarm has been evaluated. In batch mode, it evaluates the whole swarm first.
+   It returns true if the swarm is ready for another iteration and false if the
+   computation has terminated, in which case *swarm*->reason says why.
 */
 
 bool pso_finalize(PSO_SWARM_T *swarm);
 
+/*
+   This function runs the optimization to completion using a pool of *nthreads*
+   threads (the calling thread included) which persist for the whole run.
+   Rather than a fixed share, each thread claims PSO_CHUNK particles at a time
+   from a shared cursor until the iteration is drained, so slow evaluations
+   don't hold up the threads with cheap ones. The threads meet at a barrier
+   after each round of evaluations, and the one thread the barrier singles out
+   (which isn't necessarily the last to arrive) performs the serial
+   *pso_finalize()* and *pso_shuffle()* steps (and calls *callback* if it isn't
+   NULL) while the others wait. If *cpus* is not NULL, it should hold
+   *nthreads* CPU numbers, and thread i will be pinned to CPU *cpus*[i] for the
+   duration of the run. The thread count is clipped to the swarm size. It
+   returns false if the threads could not be started, in which case the swarm
+   is left untouched.
+*/
+
+bool pso_run_parallel(
+        PSO_SWARM_T *swarm,
+        size_t nthreads,
+        int *cpus,
+        PSO_CALLBACK_T callback
+        );
+
+/*
+   This function runs the optimization in asynchronous mode, in which there is
+   no synchronization point between iterations. Each of the *nthreads* workers
+   (the calling thread included) takes the next particle from its own queue, or
+   steals one from another worker's queue if its own is empty, then moves it,
+   evaluates it and immediately informs its neighbours of any improvement, so a
+   slow evaluation never holds up the others. Exactly *swarm*->max_evals further
+   evaluations are performed. The *cpus* and *callback* arguments behave as in
+   *pso_run_parallel()*, except that the callback is invoked after every
+   *swarm*->size evaluations. Results are not reproducible with more than one
+   thread, and batch mode is not supported. It returns false if the threads
+   could not be started (or on invalid parameters).
+*/
+
+bool pso_run_async(
+        PSO_SWARM_T *swarm,
+        size_t nthreads,
+        int *cpus,
+        PSO_CALLBACK_T callback
+        );
+
+/*
+   This function saves the complete state of the swarm, including the state of
+   every RNG stream, to a versioned binary image at *path*. The image is written
+   to a temporary file next to *path*, flushed to disk and then renamed over
+   *path*, so an interrupted write never leaves a corrupt checkpoint behind. It
+   is only valid between iterations of *pso_run_parallel()* (e.g. from its
+   callback) or when no run is in progress. In particular, it must not be
+   called from the callback of *pso_run_async()*, since the other workers keep
+   moving particles and have claimed evaluations which the image would lose.
+   It returns false if the image couldn't be written.
+*/
+
+bool pso_checkpoint(PSO_SWARM_T *swarm, char *path);
+
+/*
+   This function initializes *swarm* from an image written by
+   *pso_checkpoint()*, using *fitness* as the fitness function. Provided the
+   same RNG is compiled in and the same fitness function is supplied, the
+   restored swarm continues exactly as the original would have. The cache and
+   batch mode are not part of the image. It returns false if the image is
+   missing, corrupt, from another version or from another RNG, or on a memory
+   allocation error.
+*/
+
+bool pso_restore(PSO_SWARM_T *swarm, char *path, PSO_FITNESS_T fitness);
+
 /*
    This function writes the current best position and corresponding fitness
-   function value to the *results* structure.
+   function value to the *results* structure. The position is left out if the
+   dimension of the swarm exceeds PSO_RESULTS_MAX_DIM.
 */
 
 void pso_write_optimum(PSO_SWARM_T *swarm, PSO_RESULTS_T *results);
 
+/*
+   This function writes the current best position to *pos*, which should have
+   room for as many doubles as the dimension of the swarm.
+*/
+
+void pso_write_position(PSO_SWARM_T *swarm, double *pos);
+
 /*
    This function frees all the memory held by an initialized swarm. Note that
    it does not free the *swarm* structure itself, as it is not necessarily
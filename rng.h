@@ -9,6 +9,7 @@
    values drawn from the distributions needed by PSO.
 */
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef void *RNG_STATE_T;
@@ -31,11 +32,22 @@ char *rng_name(void);
 
 char *rng_uid(void);
 
+/*
+   This constant defines the alignment (in bytes) of generator states. Since
+   the states of different particles are updated by different threads, each
+   state should take up whole cache lines of its own.
+*/
+
+#ifndef RNG_ALIGNMENT
+#define RNG_ALIGNMENT 64
+#endif
+
 /*
    This function allocates a new instance of the opaque state structure needed
-   by the RNG. It should return NULL on failure. The state is then passed to
-   (and updated by) every subsequent call to the RNG. It should always be freed
-   by the corresponding *rng_free_state()* function.
+   by the RNG, aligned to and padded out to a multiple of RNG_ALIGNMENT bytes.
+   It should return NULL on failure. The state is then passed to (and updated
+   by) every subsequent call to the RNG. It should always be freed by the
+   corresponding *rng_free_state()* function.
 */
 
 RNG_STATE_T rng_allocate_state(void);
@@ -70,6 +82,49 @@ void rng_initialize_state(RNG_STATE_T state, RNG_SEED_T seed);
 
 void rng_derive_seed(RNG_SEED_T seed, char *phrase);
 
+/*
+   This function copies the state *src* into *dst*, which must have been
+   allocated by *rng_allocate_state()*. Generators which can't be duplicated
+   (such as those backed by the OS) should initialize *dst* as a fresh,
+   independent state instead.
+*/
+
+void rng_copy_state(RNG_STATE_T dst, RNG_STATE_T src);
+
+/*
+   This function advances the state as if a very large number of blocks (2^64
+   for xorshift128+) had been drawn. Copying a state and then jumping the
+   original repeatedly yields non-overlapping substreams, which is how PSO gives
+   every particle a generator of its own. It may do nothing for generators
+   whose outputs are independent anyway.
+*/
+
+void rng_jump(RNG_STATE_T state);
+
+/*
+   This function returns the number of bytes needed to save a state with
+   *rng_save_state()*. It may be 0 for generators without reproducible state.
+*/
+
+size_t rng_state_size(void);
+
+/*
+   This function writes *rng_state_size()* bytes to *buf* from which
+   *rng_load_state()* can recreate *state* exactly, so that a generator can be
+   checkpointed. The format is opaque and need not be portable across
+   platforms.
+*/
+
+void rng_save_state(RNG_STATE_T state, void *buf);
+
+/*
+   This function restores an allocated *state* from a buffer written by
+   *rng_save_state()*. Generators without reproducible state should initialize
+   *state* afresh instead.
+*/
+
+void rng_load_state(RNG_STATE_T state, const void *buf);
+
 /*
    This function returns a 64-bit value (which should ideally be drawn from a
    uniform distribution) and updates the internal state.
@@ -77,4 +132,14 @@ void rng_derive_seed(RNG_SEED_T seed, char *phrase);
 
 uint64_t rng_next_block(RNG_STATE_T state);
 
+/*
+   This function writes *n* blocks to *buf*, exactly as *n* calls to
+   *rng_next_block()* would, and updates the internal state. Since the RNG
+   isn't inlined into its callers, drawing the blocks in bulk avoids paying for
+   a call per block, and generators which work on many blocks at once can
+   produce them straight into *buf*.
+*/
+
+void rng_fill_blocks(RNG_STATE_T state, uint64_t *buf, size_t n);
+
 #endif
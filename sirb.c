@@ -0,0 +1,980 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef EXCLUDE_GSL
+#include <pthread.h>
+
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_odeiv2.h>
+#endif
+
+#include "sirb.h"
+
+#include "nord.dat"
+
+/*
+   This constant defines the number of parameter sets *sirb_batch_fitness()*
+   integrates side by side, one per SIMD lane. Unless EXCLUDE_SIMD is defined,
+   GCC-compatible compilers hold the lanes in generic vector types, as in
+   *util.h*, and on x86-64 the stepping function is cloned for AVX-512 and
+   AVX2. Otherwise there is a single lane.
+*/
+
+#ifndef SIRB_LANES
+#define SIRB_LANES 8
+#endif
+
+#if defined(__GNUC__) && !defined(EXCLUDE_SIMD)
+typedef double SIRB_VECTOR_T
+    __attribute__((vector_size(SIRB_LANES * sizeof(double))));
+
+typedef int64_t SIRB_BITS_T
+    __attribute__((vector_size(SIRB_LANES * sizeof(int64_t))));
+#else
+#undef SIRB_LANES
+#define SIRB_LANES 1
+
+typedef double SIRB_VECTOR_T;
+
+typedef int64_t SIRB_BITS_T;
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(EXCLUDE_SIMD)
+#define SIRB_CLONES __attribute__((target_clones( \
+                "arch=skylake-avx512", \
+                "arch=haswell", \
+                "default" \
+                )))
+#else
+#define SIRB_CLONES
+#endif
+
+// This is lane j of a vector.
+#define LANE(v, j) (((double *)&(v))[j])
+
+char *sirb_names[] =
+{
+    "B_0",
+    "h",
+    "beta_B",
+    "beta_I",
+    "eta",
+    "gamma",
+    "delta",
+    "omega"
+};
+
+/*
+   The system has this many variables (S, I, R and B), and every solver below
+   is specialized for it at compile time.
+*/
+
+#define SIRB_VARS 4
+
+static inline void derivative(
+        const double *depvars,
+        double *dydt,
+        const double *params
+        )
+{
+    // Give everything names for instructive purposes.
+
+    double S = depvars[0];
+    double I = depvars[1];
+    double R = depvars[2];
+    double B = depvars[3];
+
+    double N = S + I + R;
+    double b = params[0];
+    double d = params[1];
+    double kappa = params[2];
+    double beta_B = params[3];
+    double beta_I = params[4];
+    double eta = params[5];
+    double gamma = params[6];
+    double delta = params[7];
+    double omega = params[8];
+
+    dydt[0] = b*N - d*S - beta_B*(B*S/(kappa + B)) - beta_I*(S*I/N) + omega*R;
+    dydt[1] = -d*I + beta_B*(B*S/(kappa + B)) + beta_I*(S*I/N) - gamma*I;
+    dydt[2] = -d*R + gamma*I - omega*R;
+    dydt[3] = eta*I - delta*B;
+}
+
+#ifndef EXCLUDE_GSL
+static int sirb(
+        double time,
+        const double *depvars,
+        double *dydt,
+        void *raw_params
+        )
+{
+    (void)time;
+
+    derivative(depvars, dydt, (double *)raw_params);
+
+    return GSL_SUCCESS;
+}
+
+/*
+   The GSL stepper, controller and evolution objects are allocated once per
+   thread and reset before each solve, instead of being created and destroyed
+   on every fitness evaluation. They are freed when the thread exits.
+*/
+
+typedef struct
+{
+    gsl_odeiv2_step *step;
+    gsl_odeiv2_control *control;
+    gsl_odeiv2_evolve *evolve;
+} WORKSPACE_T;
+
+static pthread_key_t workspace_key;
+
+static pthread_once_t workspace_once = PTHREAD_ONCE_INIT;
+
+static void free_workspace(void *data)
+{
+    WORKSPACE_T *workspace = (WORKSPACE_T *)data;
+
+    if (workspace->evolve)
+        gsl_odeiv2_evolve_free(workspace->evolve);
+
+    if (workspace->control)
+        gsl_odeiv2_control_free(workspace->control);
+
+    if (workspace->step)
+        gsl_odeiv2_step_free(workspace->step);
+
+    free(workspace);
+}
+
+static void create_workspace_key(void)
+{
+    pthread_key_create(&workspace_key, free_workspace);
+}
+
+static WORKSPACE_T *get_workspace(void)
+{
+    pthread_once(&workspace_once, create_workspace_key);
+
+    WORKSPACE_T *workspace = pthread_getspecific(workspace_key);
+
+    if (workspace)
+        return workspace;
+
+    workspace = malloc(sizeof(WORKSPACE_T));
+
+    if (!workspace)
+        return NULL;
+
+    workspace->step = gsl_odeiv2_step_alloc(
+            gsl_odeiv2_step_rkf45,
+            SIRB_VARS
+            );
+    workspace->control = gsl_odeiv2_control_y_new(1e-6, 1e-3);
+    workspace->evolve = gsl_odeiv2_evolve_alloc(SIRB_VARS);
+
+    if (!(workspace->step && workspace->control && workspace->evolve))
+    {
+        free_workspace(workspace);
+
+        return NULL;
+    }
+
+    pthread_setspecific(workspace_key, workspace);
+
+    return workspace;
+}
+
+/*
+   This function integrates the system through *timeline* and writes the mean
+   absolute deviation of the scaled infective count from *observed* to *loss*.
+   Since the deviation only grows, it stops integrating as soon as the partial
+   mean reaches *bound*, in which case *loss* is the partial mean instead.
+   This is the reference solver, which lets GSL's rkf45 stepper shorten its
+   steps to land on every observation.
+*/
+
+static bool solve_gsl(
+        double *params,
+        double *initial,
+        double *timeline,
+        size_t timeline_len,
+        double scale,
+        double *observed,
+        double bound,
+        double *loss
+        )
+{
+    gsl_odeiv2_system system =
+    {
+        .function = sirb,
+        .jacobian = NULL,
+        .dimension = SIRB_VARS,
+        .params = params
+    };
+
+    WORKSPACE_T *workspace = get_workspace();
+
+    if (!workspace)
+        return false;
+
+    gsl_odeiv2_step_reset(workspace->step);
+    gsl_odeiv2_evolve_reset(workspace->evolve);
+
+    double t = 0;
+    double h = 1e-6;
+
+    double mad = 0;
+
+    for (size_t i = 0; i < timeline_len; ++i)
+    {
+        double t1 = timeline[i];
+
+        while (t < t1)
+        {
+            if (gsl_odeiv2_evolve_apply(
+                    workspace->evolve,
+                    workspace->control,
+                    workspace->step,
+                    &system,
+                    &t,
+                    t1,
+                    &h,
+                    initial
+                    ) != GSL_SUCCESS)
+                return false;
+        }
+
+        mad += fabs(initial[1] * scale - observed[i]);
+
+        if (mad / timeline_len >= bound)
+            break;
+    }
+
+    *loss = mad / timeline_len;
+
+    return true;
+}
+#endif
+
+/*
+   These are the Dormand-Prince RK5(4) coefficients: the stages (the last of
+   which is the fifth order solution, so its derivative is also the first
+   stage of the next step), the differences from fourth order for the error
+   estimate and the coefficients of the fourth order continuous extension
+   (from Hairer, Norsett and Wanner's DOPRI5).
+*/
+
+static const double dopri_a[6][6] =
+{
+    { 1.0 / 5 },
+    { 3.0 / 40, 9.0 / 40 },
+    { 44.0 / 45, -56.0 / 15, 32.0 / 9 },
+    {
+        19372.0 / 6561,
+        -25360.0 / 2187,
+        64448.0 / 6561,
+        -212.0 / 729
+    },
+    {
+        9017.0 / 3168,
+        -355.0 / 33,
+        46732.0 / 5247,
+        49.0 / 176,
+        -5103.0 / 18656
+    },
+    {
+        35.0 / 384,
+        0,
+        500.0 / 1113,
+        125.0 / 192,
+        -2187.0 / 6784,
+        11.0 / 84
+    }
+};
+
+static const double dopri_e[7] =
+{
+    71.0 / 57600,
+    0,
+    -71.0 / 16695,
+    71.0 / 1920,
+    -17253.0 / 339200,
+    22.0 / 525,
+    -1.0 / 40
+};
+
+static const double dopri_d[7] =
+{
+    -12715105075.0 / 11282082432,
+    0,
+    87487479700.0 / 32700410799,
+    -10690763975.0 / 1880347072,
+    701980252875.0 / 199316789632,
+    -1453857185.0 / 822651844,
+    69997945.0 / 29380423
+};
+
+/*
+   This function is *solve_gsl()* with a built-in Dormand-Prince integrator,
+   which keeps its whole state on the stack. It steps freely past the
+   observations and reads the infective count at each of them off the
+   continuous extension of the step which covers it. The error is measured in
+   the root mean square norm against the same tolerances (1e-6 absolute plus
+   1e-3 relative), and the step size changes by at most a factor of 5 up (but
+   not right after a rejected step) or 0.2 down.
+*/
+
+static bool solve_dopri(
+        double *params,
+        double *initial,
+        double *timeline,
+        size_t timeline_len,
+        double scale,
+        double *observed,
+        double bound,
+        double *loss
+        )
+{
+    double k[7][SIRB_VARS];
+    double trial[SIRB_VARS];
+
+    derivative(initial, k[0], params);
+
+    double end = timeline[timeline_len - 1];
+
+    double t = 0;
+    double h = 1e-6;
+
+    bool rejected = false;
+
+    double mad = 0;
+
+    size_t i = 0;
+
+    while (i < timeline_len)
+    {
+        bool last = (t + h >= end);
+
+        if (last)
+            h = end - t;
+
+        for (unsigned s = 1; s < 7; ++s)
+        {
+            for (unsigned v = 0; v < SIRB_VARS; ++v)
+            {
+                double sum = 0;
+
+                for (unsigned m = 0; m < s; ++m)
+                    sum += dopri_a[s - 1][m] * k[m][v];
+
+                trial[v] = initial[v] + h * sum;
+            }
+
+            derivative(trial, k[s], params);
+        }
+
+        double err = 0;
+
+        for (unsigned v = 0; v < SIRB_VARS; ++v)
+        {
+            double sum = 0;
+
+            for (unsigned s = 0; s < 7; ++s)
+                sum += dopri_e[s] * k[s][v];
+
+            double y = (fabs(initial[v]) > fabs(trial[v])) ?
+                fabs(initial[v]) : fabs(trial[v]);
+
+            double ratio = h * sum / (1e-6 + 1e-3 * y);
+
+            err += ratio * ratio;
+        }
+
+        err = sqrt(err / SIRB_VARS);
+
+        // This also catches a step which overflowed to NaN.
+        double factor = 0.9 * pow(err, -0.2);
+
+        factor = (factor > 0.2) ? factor : 0.2;
+        factor = (factor < 5) ? factor : 5;
+
+        if (!(err <= 1))
+        {
+            h *= factor;
+            rejected = true;
+
+            if (t + h == t)
+                return false;
+
+            continue;
+        }
+
+        double next = last ? end : t + h;
+
+        if (timeline[i] <= next)
+        {
+            // Only the infective count is ever interpolated.
+            double ydiff = trial[1] - initial[1];
+            double bspl = h * k[0][1] - ydiff;
+            double bend = ydiff - h * k[6][1] - bspl;
+
+            double cont = 0;
+
+            for (unsigned s = 0; s < 7; ++s)
+                cont += dopri_d[s] * k[s][1];
+
+            cont *= h;
+
+            for (; i < timeline_len && timeline[i] <= next; ++i)
+            {
+                double theta = (timeline[i] - t) / h;
+                double theta1 = 1 - theta;
+
+                double I = initial[1] + theta * (ydiff + theta1 * (bspl +
+                            theta * (bend + theta1 * cont)));
+
+                mad += fabs(I * scale - observed[i]);
+
+                if (mad / timeline_len >= bound)
+                    goto solve_dopri_done;
+            }
+        }
+
+        memcpy(initial, trial, sizeof(trial));
+        memcpy(k[0], k[6], sizeof(k[0]));
+
+        t = next;
+
+        if (rejected)
+            factor = (factor < 1) ? factor : 1;
+
+        h *= factor;
+        rejected = false;
+    }
+
+solve_dopri_done:
+    *loss = mad / timeline_len;
+
+    return true;
+}
+
+double sirb_lower[] =
+{
+    0,
+    0.001,
+    0.001,
+    0.001,
+    0.001,
+    1.0 / 14,
+    1.0 / 40,
+    0.0001
+};
+
+double sirb_upper[] =
+{
+    1,
+    1,
+    1,
+    0.5,
+    1,
+    1.0 / 2,
+    1.0 / 3,
+    1.0 / 360
+};
+
+// This writes the initial state and the parameters of the system for *pos*.
+static void set_up(const double *pos, double *initial, double *params)
+{
+    initial[0] = S_INIT;
+    initial[1] = I_INIT / pos[1];
+    initial[2] = 0;
+    initial[3] = pos[0] * 1e6;
+
+    params[0] = 0.000072;
+    params[1] = 0.000044;
+    params[2] = 1e6;
+
+    memcpy(params + 3, pos + 2, 6 * sizeof(double));
+}
+
+/*
+   Both fitness functions differ only in their solver, which has the signature
+   of *solve_gsl()*.
+*/
+
+typedef bool (*SOLVER_T)(
+        double *params,
+        double *initial,
+        double *timeline,
+        size_t timeline_len,
+        double scale,
+        double *observed,
+        double bound,
+        double *loss
+        );
+
+static double fitness(SOLVER_T solver, double *pos, double bound)
+{
+    double initial[SIRB_VARS];
+    double params[9];
+
+    set_up(pos, initial, params);
+
+    double mad;
+
+    if (!solver(params, initial, times, TIMES_LEN, pos[1], ivals, bound, &mad))
+    {
+        fputs("Solver error!\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    return mad;
+}
+
+double sirb_fitness(double *pos, double bound)
+{
+    return fitness(solve_dopri, pos, bound);
+}
+
+#ifndef EXCLUDE_GSL
+double sirb_fitness_gsl(double *pos, double bound)
+{
+    return fitness(solve_gsl, pos, bound);
+}
+#endif
+
+/*
+   The batch integrator takes the same Dormand-Prince steps as *solve_dopri()*,
+   under the same error control, but for SIRB_LANES systems at once. The
+   state, the stages and the step size are vectors with one system per lane,
+   while each lane keeps its own time, next observation and running loss. A
+   lane whose set is done, or has reached its bound, takes up the next one in
+   the batch (*owner* is the set's row, or SIZE_MAX once the batch has run
+   out). The first stage *k*[0] carries over from one step to the next.
+*/
+
+typedef struct
+{
+    SIRB_VECTOR_T params[9];
+
+    SIRB_VECTOR_T y[SIRB_VARS];
+
+    SIRB_VECTOR_T k[7][SIRB_VARS];
+
+    SIRB_VECTOR_T h;
+
+    double t[SIRB_LANES];
+
+    double scale[SIRB_LANES];
+
+    double bound[SIRB_LANES];
+
+    double mad[SIRB_LANES];
+
+    bool rejected[SIRB_LANES];
+
+    size_t next[SIRB_LANES];
+
+    size_t owner[SIRB_LANES];
+} LANES_T;
+
+// This is *derivative()* for every lane at once.
+static inline void derivative_lanes(
+        const SIRB_VECTOR_T *depvars,
+        SIRB_VECTOR_T *dydt,
+        const SIRB_VECTOR_T *params
+        )
+{
+    SIRB_VECTOR_T S = depvars[0];
+    SIRB_VECTOR_T I = depvars[1];
+    SIRB_VECTOR_T R = depvars[2];
+    SIRB_VECTOR_T B = depvars[3];
+
+    SIRB_VECTOR_T N = S + I + R;
+
+    SIRB_VECTOR_T infection_B = params[3] * (B * S / (params[2] + B));
+    SIRB_VECTOR_T infection_I = params[4] * (S * I / N);
+
+    dydt[0] = params[0] * N - params[1] * S - infection_B - infection_I +
+        params[8] * R;
+    dydt[1] = -params[1] * I + infection_B + infection_I - params[6] * I;
+    dydt[2] = -params[1] * R + params[6] * I - params[8] * R;
+    dydt[3] = params[5] * I - params[7] * B;
+}
+
+/*
+   This writes the absolute value of every lane of *x* to *out*, by clearing
+   the sign bits. (Vectors are passed by address, since the ABI for passing
+   them by value depends on the target.)
+*/
+
+static inline void magnitude(const SIRB_VECTOR_T *x, SIRB_VECTOR_T *out)
+{
+    SIRB_BITS_T bits;
+
+    memcpy(&bits, x, sizeof(bits));
+
+    bits &= INT64_MAX;
+
+    memcpy(out, &bits, sizeof(*out));
+}
+
+/*
+   The step size of *solve_dopri()* changes by 0.9 / err^(1/5), clamped to
+   [0.2, 5], where err is the root mean square of the scaled error. The
+   integrator below works on the mean square instead, which it clamps to these
+   limits (the squares of (0.9 / 5)^5 and (0.9 / 0.2)^5) before taking its
+   tenth root, so that the factor comes out within the clamp.
+*/
+
+#define SIRB_SQUARE_MIN (0.18 * 0.18 * 0.18 * 0.18 * 0.18 * \
+        0.18 * 0.18 * 0.18 * 0.18 * 0.18)
+#define SIRB_SQUARE_MAX (4.5 * 4.5 * 4.5 * 4.5 * 4.5 * \
+        4.5 * 4.5 * 4.5 * 4.5 * 4.5)
+
+/*
+   This writes x^(-1/10) to *out* for every lane x of *x*, which should lie
+   between SIRB_SQUARE_MIN and SIRB_SQUARE_MAX, without a call to pow() per
+   lane. Read as an integer, the bits of a double are roughly a scaled and
+   shifted base 2 logarithm, so integer arithmetic on them gives a first guess
+   within 7%, which four Newton steps bring to within 1e-7.
+*/
+
+static inline void inverse_tenth_root(
+        const SIRB_VECTOR_T *x,
+        SIRB_VECTOR_T *out
+        )
+{
+    SIRB_BITS_T bits;
+
+    memcpy(&bits, x, sizeof(bits));
+
+    // The bits of 1.0, times 11 / 10.
+    bits = INT64_C(0x3FF0000000000000) / 10 * 11 - bits / 10;
+
+    SIRB_VECTOR_T y;
+
+    memcpy(&y, &bits, sizeof(y));
+
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        SIRB_VECTOR_T y2 = y * y;
+        SIRB_VECTOR_T y5 = y2 * y2 * y;
+
+        y = y * (1.1 - 0.1 * *x * y5 * y5);
+    }
+
+    *out = y;
+}
+
+/*
+   This takes a trial step of *lanes*->h in every lane, writing the new states
+   to *trial* and the stages to *lanes*->k[1..6]. It writes the mean square of
+   the scaled error to *square* (as INFINITY if it is NaN, so that the step is
+   rejected) and the factor by which to change the step size to *factor*.
+*/
+
+SIRB_CLONES static void step_lanes(
+        LANES_T *lanes,
+        SIRB_VECTOR_T *trial,
+        SIRB_VECTOR_T *square,
+        SIRB_VECTOR_T *factor
+        )
+{
+    SIRB_VECTOR_T h = lanes->h;
+
+    for (unsigned s = 1; s < 7; ++s)
+    {
+        for (unsigned v = 0; v < SIRB_VARS; ++v)
+        {
+            SIRB_VECTOR_T sum = dopri_a[s - 1][0] * lanes->k[0][v];
+
+            for (unsigned m = 1; m < s; ++m)
+                sum += dopri_a[s - 1][m] * lanes->k[m][v];
+
+            trial[v] = lanes->y[v] + h * sum;
+        }
+
+        derivative_lanes(trial, lanes->k[s], lanes->params);
+    }
+
+    SIRB_VECTOR_T err = { 0 };
+
+    for (unsigned v = 0; v < SIRB_VARS; ++v)
+    {
+        SIRB_VECTOR_T sum = dopri_e[0] * lanes->k[0][v];
+
+        for (unsigned s = 2; s < 7; ++s)
+            sum += dopri_e[s] * lanes->k[s][v];
+
+        SIRB_VECTOR_T a, b, gap;
+
+        magnitude(lanes->y + v, &a);
+        magnitude(trial + v, &b);
+
+        gap = a - b;
+
+        magnitude(&gap, &gap);
+
+        // This is the larger of the two.
+        SIRB_VECTOR_T y = 0.5 * (a + b + gap);
+
+        SIRB_VECTOR_T ratio = h * sum / (1e-6 + 1e-3 * y);
+
+        err += ratio * ratio;
+    }
+
+    err *= 1.0 / SIRB_VARS;
+
+    SIRB_VECTOR_T clamped;
+
+    for (unsigned j = 0; j < SIRB_LANES; ++j)
+    {
+        double e = LANE(err, j);
+
+        if (isnan(e))
+            LANE(err, j) = e = INFINITY;
+
+        e = (e > SIRB_SQUARE_MIN) ? e : SIRB_SQUARE_MIN;
+        e = (e < SIRB_SQUARE_MAX) ? e : SIRB_SQUARE_MAX;
+
+        LANE(clamped, j) = e;
+    }
+
+    *square = err;
+
+    inverse_tenth_root(&clamped, factor);
+
+    *factor *= 0.9;
+}
+
+// This starts lane j on the parameter set in row *owner* of *positions*.
+static void load_lane(
+        LANES_T *lanes,
+        unsigned j,
+        const double *positions,
+        const double *bounds,
+        size_t owner,
+        size_t dim
+        )
+{
+    double initial[SIRB_VARS];
+    double params[9];
+    double dydt[SIRB_VARS];
+
+    set_up(positions + owner * dim, initial, params);
+    derivative(initial, dydt, params);
+
+    for (unsigned v = 0; v < SIRB_VARS; ++v)
+    {
+        LANE(lanes->y[v], j) = initial[v];
+        LANE(lanes->k[0][v], j) = dydt[v];
+    }
+
+    for (unsigned i = 0; i < 9; ++i)
+        LANE(lanes->params[i], j) = params[i];
+
+    LANE(lanes->h, j) = 1e-6;
+
+    lanes->t[j] = 0;
+    lanes->scale[j] = positions[owner * dim + 1];
+    lanes->bound[j] = bounds ? bounds[owner] : INFINITY;
+    lanes->mad[j] = 0;
+    lanes->rejected[j] = false;
+    lanes->next[j] = 0;
+    lanes->owner[j] = owner;
+}
+
+/*
+   This accepts or rejects the trial step of lane j as *solve_dopri()* would,
+   adds the deviations at the observations it covers to the lane's loss and
+   adjusts the step size. It returns false if the step can't be made small
+   enough to meet the tolerance, and otherwise writes whether the lane's set
+   is done (with its loss in *fitness*) to *done*.
+*/
+
+static bool control_lane(
+        LANES_T *lanes,
+        unsigned j,
+        const SIRB_VECTOR_T *trial,
+        double square,
+        double factor,
+        bool last,
+        double *fitness,
+        bool *done
+        )
+{
+    double t = lanes->t[j];
+    double h = LANE(lanes->h, j);
+
+    *done = false;
+
+    if (!(square <= 1))
+    {
+        LANE(lanes->h, j) = h * factor;
+        lanes->rejected[j] = true;
+
+        return t + h * factor != t;
+    }
+
+    double next = last ? times[TIMES_LEN - 1] : t + h;
+
+    size_t i = lanes->next[j];
+
+    if (times[i] <= next)
+    {
+        double y0 = LANE(lanes->y[1], j);
+        double k[7];
+
+        for (unsigned s = 0; s < 7; ++s)
+            k[s] = LANE(lanes->k[s][1], j);
+
+        double ydiff = LANE(trial[1], j) - y0;
+        double bspl = h * k[0] - ydiff;
+        double bend = ydiff - h * k[6] - bspl;
+
+        double cont = 0;
+
+        for (unsigned s = 0; s < 7; ++s)
+            cont += dopri_d[s] * k[s];
+
+        cont *= h;
+
+        for (; i < TIMES_LEN && times[i] <= next; ++i)
+        {
+            double theta = (times[i] - t) / h;
+            double theta1 = 1 - theta;
+
+            double I = y0 + theta * (ydiff + theta1 * (bspl +
+                        theta * (bend + theta1 * cont)));
+
+            lanes->mad[j] += fabs(I * lanes->scale[j] - ivals[i]);
+
+            if (lanes->mad[j] / TIMES_LEN >= lanes->bound[j])
+            {
+                *done = true;
+
+                break;
+            }
+        }
+
+        lanes->next[j] = i;
+    }
+
+    if (*done || i == TIMES_LEN)
+    {
+        fitness[lanes->owner[j]] = lanes->mad[j] / TIMES_LEN;
+        *done = true;
+
+        return true;
+    }
+
+    for (unsigned v = 0; v < SIRB_VARS; ++v)
+    {
+        LANE(lanes->y[v], j) = LANE(trial[v], j);
+        LANE(lanes->k[0][v], j) = LANE(lanes->k[6][v], j);
+    }
+
+    lanes->t[j] = next;
+
+    if (lanes->rejected[j])
+        factor = (factor < 1) ? factor : 1;
+
+    LANE(lanes->h, j) = h * factor;
+    lanes->rejected[j] = false;
+
+    return true;
+}
+
+void sirb_batch_fitness(
+        const double *positions,
+        const double *bounds,
+        size_t n,
+        size_t dim,
+        double *out,
+        void *ctx
+        )
+{
+    (void)ctx;
+
+    if (!n)
+        return;
+
+    LANES_T lanes;
+
+    // Lanes without a set of their own shadow the first one, harmlessly.
+    for (unsigned j = 0; j < SIRB_LANES; ++j)
+    {
+        load_lane(&lanes, j, positions, bounds, (j < n) ? j : 0, dim);
+
+        if (j >= n)
+            lanes.owner[j] = SIZE_MAX;
+    }
+
+    size_t loaded = (n < SIRB_LANES) ? n : SIRB_LANES;
+
+    size_t active = loaded;
+
+    double end = times[TIMES_LEN - 1];
+
+    while (active)
+    {
+        bool last[SIRB_LANES];
+
+        for (unsigned j = 0; j < SIRB_LANES; ++j)
+        {
+            last[j] = (lanes.t[j] + LANE(lanes.h, j) >= end);
+
+            if (last[j])
+                LANE(lanes.h, j) = end - lanes.t[j];
+        }
+
+        SIRB_VECTOR_T trial[SIRB_VARS];
+        SIRB_VECTOR_T square;
+        SIRB_VECTOR_T factor;
+
+        step_lanes(&lanes, trial, &square, &factor);
+
+        for (unsigned j = 0; j < SIRB_LANES; ++j)
+        {
+            if (lanes.owner[j] == SIZE_MAX)
+                continue;
+
+            bool done;
+
+            if (!control_lane(
+                        &lanes,
+                        j,
+                        trial,
+                        LANE(square, j),
+                        LANE(factor, j),
+                        last[j],
+                        out,
+                        &done
+                        ))
+            {
+                fputs("Solver error!\n", stderr);
+                exit(EXIT_FAILURE);
+            }
+
+            if (!done)
+                continue;
+
+            if (loaded < n)
+                load_lane(&lanes, j, positions, bounds, loaded++, dim);
+            else
+            {
+                lanes.owner[j] = SIZE_MAX;
+
+                --active;
+            }
+        }
+    }
+}
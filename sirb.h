@@ -0,0 +1,65 @@
+#ifndef _SIRB_H
+#define _SIRB_H
+
+/*
+   This file provides definitions for the SIRB cholera model fitted to the
+   data in *nord.dat*. The parameters are B_0, h, beta_B, beta_I, eta, gamma,
+   delta and omega, in that order.
+*/
+
+#include <stddef.h>
+
+#define SIRB_DIM 8
+
+// These are the parameter names and the bounds of the search space.
+
+extern char *sirb_names[SIRB_DIM];
+
+extern double sirb_lower[SIRB_DIM];
+
+extern double sirb_upper[SIRB_DIM];
+
+/*
+   This function is the PSO fitness function for the model. It returns the mean
+   absolute deviation of the simulated infective count from the data, giving up
+   early once it reaches *bound*. It is thread-safe, and exits the program if
+   the ODE solver fails. The solver is a built-in Dormand-Prince integrator
+   specialized for the four variables of the system, which allocates nothing
+   and reads the observations off its dense output instead of shortening its
+   steps to land on each of them.
+*/
+
+double sirb_fitness(double *pos, double bound);
+
+/*
+   This function is *sirb_fitness()* with GSL's rkf45 stepper instead, which
+   is kept as the reference for the accuracy of the other solvers. The results
+   agree to within the tolerances rather than bit for bit. It is left out when
+   EXCLUDE_GSL is defined, which removes the dependence on GSL.
+*/
+
+#ifndef EXCLUDE_GSL
+double sirb_fitness_gsl(double *pos, double bound);
+#endif
+
+/*
+   This function is the batch fitness function for the model (see
+   PSO_BATCH_FITNESS_T in *pso.h*, though *ctx* is unused). It integrates
+   SIRB_LANES parameter sets at a time in lockstep, one per SIMD lane, each
+   with its own adaptive step size, using the same method and tolerances as
+   *sirb_fitness()*, and gives up on a set once its loss reaches its bound. The
+   results agree with *sirb_fitness()* to within the tolerances rather than
+   bit for bit. It keeps all of its state on the stack, so it can be called
+   from several threads at once. It exits the program if the solver fails.
+*/
+
+void sirb_batch_fitness(
+        const double *positions,
+        const double *bounds,
+        size_t n,
+        size_t dim,
+        double *out,
+        void *ctx
+        );
+
+#endif
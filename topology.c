@@ -0,0 +1,204 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "topology.h"
+#include "transform.h"
+
+static char *topology_names[] =
+{
+    "adaptive",
+    "random",
+    "ring",
+    "grid",
+    "full"
+};
+
+char *topology_name(TOPOLOGY_KIND_T kind)
+{
+    return topology_names[kind];
+}
+
+/*
+   This writes the particles informed by particle *i*, other than itself, to
+   *row* and returns their number. Random links are left pointing at *i* until
+   they are drawn.
+*/
+
+static size_t fill_row(TOPOLOGY_T *topology, size_t i, uint64_t *row)
+{
+    size_t n = topology->size;
+
+    size_t count = 0;
+
+    switch (topology->kind)
+    {
+        case TOPOLOGY_ADAPTIVE:
+        case TOPOLOGY_RANDOM:
+            for (; count < topology->k; ++count)
+                row[count] = i;
+
+            break;
+        case TOPOLOGY_RING:
+        {
+            size_t radius = (topology->k / 2) ? topology->k / 2 : 1;
+
+            // Alternating sides keeps the links distinct on a small ring.
+            for (size_t d = 1; d <= radius && count < n - 1; ++d)
+            {
+                row[count++] = (i + d) % n;
+
+                if (count < n - 1)
+                    row[count++] = (i + n - d) % n;
+            }
+
+            break;
+        }
+        case TOPOLOGY_GRID:
+        {
+            size_t width = (size_t)round(sqrt(n)) % n;
+
+            uint64_t candidates[] =
+            {
+                (i + 1) % n,
+                (i + n - 1) % n,
+                (i + width) % n,
+                (i + n - width) % n
+            };
+
+            // On a small grid, some of the candidates coincide.
+            for (size_t c = 0; c < 4; ++c)
+            {
+                size_t j = 0;
+
+                while (j < count && row[j] != candidates[c])
+                    ++j;
+
+                if (candidates[c] != i && j == count)
+                    row[count++] = candidates[c];
+            }
+
+            break;
+        }
+        case TOPOLOGY_FULL:
+            for (size_t j = 0; j < n; ++j)
+                if (j != i)
+                    row[count++] = j;
+
+            break;
+        default:
+            break;
+    }
+
+    return count;
+}
+
+// This fills in the offsets and returns the total number of links.
+static size_t layout(TOPOLOGY_T *topology)
+{
+    // The rows other than the full ones are short enough for the stack.
+    uint64_t row[topology->k + 4];
+
+    size_t total = 0;
+
+    for (size_t i = 0; i < topology->size; ++i)
+    {
+        topology->offsets[i] = total;
+
+        if (topology->kind == TOPOLOGY_FULL)
+            total += topology->size;
+        else
+            total += fill_row(topology, i, row) + 1;
+    }
+
+    topology->offsets[topology->size] = total;
+
+    return total;
+}
+
+bool topology_initialize(
+        TOPOLOGY_T *topology,
+        TOPOLOGY_KIND_T kind,
+        size_t size,
+        size_t k
+        )
+{
+    if (!(topology && kind < TOPOLOGY_KINDS && size && k))
+        goto topology_initialize_error_1;
+
+    // The full topology must fit in memory.
+    if (kind == TOPOLOGY_FULL && size > SIZE_MAX / sizeof(uint64_t) / size)
+        goto topology_initialize_error_1;
+
+    topology->kind = kind;
+    topology->size = size;
+    topology->k = k;
+
+    topology->offsets = malloc((size + 1) * sizeof(uint64_t));
+
+    if (!topology->offsets)
+        goto topology_initialize_error_1;
+
+    size_t total = layout(topology);
+
+    topology->links = malloc(total * sizeof(uint64_t));
+
+    if (!topology->links)
+        goto topology_initialize_error_2;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        uint64_t *links = topology->links + topology->offsets[i];
+
+        links[fill_row(topology, i, links)] = i;
+    }
+
+    return true;
+
+topology_initialize_error_2:
+    free(topology->offsets);
+topology_initialize_error_1:
+    return false;
+}
+
+/*
+   The rows of the random topologies all have k + 1 links, of which only the
+   first k are drawn, in place. The self-link at the end of each row is set
+   once by *topology_initialize()* and never touched again.
+*/
+
+void topology_generate(TOPOLOGY_T *topology, RNG_STATE_T state)
+{
+    TOPOLOGY_KIND_T kind = topology->kind;
+
+    if (kind != TOPOLOGY_ADAPTIVE && kind != TOPOLOGY_RANDOM)
+        return;
+
+    size_t n = topology->size;
+
+    size_t width = topology->k + 1;
+
+    for (size_t i = 0; i < n; ++i)
+        transform_integer_array(
+                state,
+                0,
+                n - 1,
+                topology->links + i * width,
+                topology->k
+                );
+}
+
+bool topology_regenerate(TOPOLOGY_T *topology, RNG_STATE_T state)
+{
+    if (topology->kind != TOPOLOGY_ADAPTIVE)
+        return false;
+
+    topology_generate(topology, state);
+
+    return true;
+}
+
+void topology_free(TOPOLOGY_T *topology)
+{
+    free(topology->offsets);
+    free(topology->links);
+}
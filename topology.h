@@ -0,0 +1,97 @@
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+
+/*
+   This file provides definitions for the neighbourhood topologies of a swarm,
+   which say which particles each particle informs. A topology is stored in
+   compressed sparse row form: the particles informed by particle i are
+   *links*[*offsets*[i]] up to (but not including) *links*[*offsets*[i + 1]],
+   and the last of them is always i itself. The links of all the particles
+   share one contiguous array sized to the actual number of links, and
+   regenerating a topology only rewrites its random links in place.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "rng.h"
+
+/*
+   These are the available topologies for a swarm of n particles with k
+   informants:
+
+   - TOPOLOGY_ADAPTIVE: each particle informs k particles drawn at random
+     (possibly the same one twice), and the draw is repeated whenever an
+     iteration fails to improve the best fitness. This is the default.
+   - TOPOLOGY_RANDOM: the same, but the draw is only repeated on a restart.
+   - TOPOLOGY_RING: particle i informs the k / 2 (at least 1) particles on
+     either side of it on a ring.
+   - TOPOLOGY_GRID: particle i informs the particles i +/- 1 and i +/- w
+     (modulo n), where w is about the square root of n, which makes up the von
+     Neumann neighbourhood of a grid wrapped around a torus. It ignores k.
+   - TOPOLOGY_FULL: every particle informs every other, which makes the whole
+     swarm a single neighbourhood. It ignores k, and needs n^2 links.
+*/
+
+typedef enum
+{
+    TOPOLOGY_ADAPTIVE,
+    TOPOLOGY_RANDOM,
+    TOPOLOGY_RING,
+    TOPOLOGY_GRID,
+    TOPOLOGY_FULL,
+    TOPOLOGY_KINDS
+} TOPOLOGY_KIND_T;
+
+typedef struct
+{
+    TOPOLOGY_KIND_T kind;
+
+    size_t size;
+
+    size_t k;
+
+    uint64_t *offsets;
+
+    uint64_t *links;
+} TOPOLOGY_T;
+
+/*
+   This function sets up a topology of the given *kind* for *size* particles
+   with *k* informants each. Every link is in place except the random ones,
+   which are left to *topology_generate()*. It returns false on invalid
+   parameters or a memory allocation error.
+*/
+
+bool topology_initialize(
+        TOPOLOGY_T *topology,
+        TOPOLOGY_KIND_T kind,
+        size_t size,
+        size_t k
+        );
+
+// This function draws all the random links of a topology from *state*.
+
+void topology_generate(TOPOLOGY_T *topology, RNG_STATE_T state);
+
+/*
+   This function is called when an iteration fails to improve the best
+   fitness. It redraws the random links of an adaptive topology and returns
+   true, and returns false without doing anything for the other kinds.
+*/
+
+bool topology_regenerate(TOPOLOGY_T *topology, RNG_STATE_T state);
+
+// This function returns a short name for a kind of topology.
+
+char *topology_name(TOPOLOGY_KIND_T kind);
+
+/*
+   This function frees the memory held by the topology (but not *topology*
+   itself).
+*/
+
+void topology_free(TOPOLOGY_T *topology);
+
+#endif
@@ -1,7 +1,5 @@
 #include <math.h>
 
-#include <pthread.h>
-
 #include "transform.h"
 
 uint64_t transform_integer(RNG_STATE_T state, uint64_t l, uint64_t u)
@@ -38,6 +36,56 @@ uint64_t transform_integer(RNG_STATE_T state, uint64_t l, uint64_t u)
     return (l + u) / 2;
 }
 
+void transform_integer_array(
+        RNG_STATE_T state,
+        uint64_t l,
+        uint64_t u,
+        uint64_t *out,
+        size_t n
+        )
+{
+    if (u <= l || u - l >= UINT32_MAX)
+    {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = transform_integer(state, l, u);
+
+        return;
+    }
+
+    uint32_t range = u - l + 1;
+
+    // Products whose low half falls below this are rejected.
+    uint32_t threshold = (uint32_t)-range % range;
+
+    uint64_t blocks[TRANSFORM_CHUNK];
+
+    unsigned tries = 0;
+
+    for (size_t i = 0; i < n;)
+    {
+        size_t len = (n - i + 1) / 2;
+
+        if (len > TRANSFORM_CHUNK)
+            len = TRANSFORM_CHUNK;
+
+        rng_fill_blocks(state, blocks, len);
+
+        for (size_t j = 0; j < 2 * len && i < n; ++j)
+        {
+            uint32_t half = blocks[j / 2] >> (32 * (j % 2));
+
+            uint64_t product = (uint64_t)half * range;
+
+            if ((uint32_t)product < threshold && ++tries < TRANSFORM_MAX_TRIES)
+                continue;
+
+            out[i++] = l + (product >> 32);
+
+            tries = 0;
+        }
+    }
+}
+
 // 2^53
 #define TRANSFORM_DENOMINATOR 0x20000000000000
 
@@ -48,55 +96,201 @@ double transform_real(RNG_STATE_T state, double l, double u)
     return fma(u - l, raw / TRANSFORM_DENOMINATOR, l);
 }
 
-double transform_normal(RNG_STATE_T state, double mu, double sigma)
+void transform_real_array(
+        RNG_STATE_T state,
+        double l,
+        double u,
+        double *out,
+        size_t n
+        )
 {
-    for (unsigned i = 0 ; i < TRANSFORM_MAX_TRIES; ++i)
+    uint64_t blocks[TRANSFORM_CHUNK];
+
+    for (size_t i = 0; i < n; i += TRANSFORM_CHUNK)
     {
-        double u = transform_real(state, -1, 1);
-        double v = transform_real(state, -1, 1);
+        size_t len = (n - i < TRANSFORM_CHUNK) ? n - i : TRANSFORM_CHUNK;
 
-        double s = u * u + v * v;
+        rng_fill_blocks(state, blocks, len);
 
-        if (s > 0 && s < 1)
-            return fma(u * sqrt(-2 * log(s) / s), sigma, mu);
-    }
+        for (size_t j = 0; j < len; ++j)
+        {
+            double raw = (double)(blocks[j] >> (64 - 53));
 
-    return mu;
+            out[i + j] = fma(u - l, raw / TRANSFORM_DENOMINATOR, l);
+        }
+    }
 }
 
 /*
-   Since this is the only function which is supposed to be called in a
-   multithreaded environment, it includes a static mutex to make sure the RNG
-   remains in a consistent state.
+   Normals are drawn with the Ziggurat method in the form given by Doornik
+   ("An improved ziggurat method to generate normal random samples", 2005).
+   The area under the density is split into TRANSFORM_LAYERS layers of equal
+   area: a base strip holding the tail, and rectangles of half-width x[i]
+   stacked on top of it. A single block gives both a uniform u on [-1, 1) (from
+   its top 53 bits) and a layer (from its low bits), and u * x[i] is accepted
+   outright whenever it falls inside the part of the layer which lies entirely
+   below the density. This happens about 99% of the time, without calling any
+   function of libm.
 */
 
-void transform_hypersphere(RNG_STATE_T state, double r, double *c, size_t d)
+#define TRANSFORM_LAYERS 128
+
+#define TRANSFORM_ZIGGURAT_R 3.442619855899
+#define TRANSFORM_ZIGGURAT_V 9.91256303526217e-3
+
+// 2^52
+#define TRANSFORM_HALF_DENOMINATOR 0x10000000000000
+
+static double layer_x[TRANSFORM_LAYERS + 1];
+
+static double layer_ratio[TRANSFORM_LAYERS];
+
+// The tables are built once, before main() runs.
+__attribute__((constructor)) static void build_layers(void)
 {
-    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    double r = TRANSFORM_ZIGGURAT_R;
+    double v = TRANSFORM_ZIGGURAT_V;
 
-    double scratch[TRANSFORM_MAX_DIM];
+    double f = exp(-0.5 * r * r);
 
-    d = (d > TRANSFORM_MAX_DIM) ? TRANSFORM_MAX_DIM : d;
+    layer_x[0] = v / f;
+    layer_x[1] = r;
+    layer_x[TRANSFORM_LAYERS] = 0;
 
-    double factor = 0;
+    for (size_t i = 2; i < TRANSFORM_LAYERS; ++i)
+    {
+        layer_x[i] = sqrt(-2 * log(v / layer_x[i - 1] + f));
+
+        f = exp(-0.5 * layer_x[i] * layer_x[i]);
+    }
 
-    pthread_mutex_lock(&mutex);
+    for (size_t i = 0; i < TRANSFORM_LAYERS; ++i)
+        layer_ratio[i] = layer_x[i + 1] / layer_x[i];
+}
 
-    double scale = r * pow(transform_real(state, 0, 1), (double)1 / d);
+static inline double block_to_signed(uint64_t block)
+{
+    return (double)(block >> (64 - 53)) / TRANSFORM_HALF_DENOMINATOR - 1;
+}
 
-    for (size_t i = 0; i < d; ++i)
+/*
+   This finishes a draw which missed the inner rectangle of its layer, drawing
+   more blocks as needed: points in the base strip are either in its rectangle
+   or in the tail beyond R, and points in the wedge of another layer are
+   accepted if they fall under the density.
+*/
+
+static double ziggurat_slow(RNG_STATE_T state, uint64_t block)
+{
+    for (unsigned i = 0; i < TRANSFORM_MAX_TRIES; ++i)
     {
-        double val = transform_normal(state, 0, 1);
+        double u = block_to_signed(block);
 
-        scratch[i] = val;
+        size_t layer = block % TRANSFORM_LAYERS;
 
-        factor += val * val;
+        if (fabs(u) < layer_ratio[layer])
+            return u * layer_x[layer];
+
+        if (layer == 0)
+        {
+            double r = TRANSFORM_ZIGGURAT_R;
+
+            for (unsigned j = 0; j < TRANSFORM_MAX_TRIES; ++j)
+            {
+                double x = log(1 - transform_real(state, 0, 1)) / r;
+                double y = log(1 - transform_real(state, 0, 1));
+
+                if (-2 * y >= x * x)
+                    return (u < 0) ? x - r : r - x;
+            }
+
+            return (u < 0) ? -r : r;
+        }
+
+        double x = u * layer_x[layer];
+
+        double outer = layer_x[layer] * layer_x[layer];
+        double inner = layer_x[layer + 1] * layer_x[layer + 1];
+
+        double f0 = exp(-0.5 * (outer - x * x));
+        double f1 = exp(-0.5 * (inner - x * x));
+
+        if (f1 + transform_real(state, 0, 1) * (f0 - f1) < 1)
+            return x;
+
+        block = rng_next_block(state);
     }
 
-    pthread_mutex_unlock(&mutex);
+    return 0;
+}
 
-    factor = scale / sqrt(factor);
+double transform_normal(RNG_STATE_T state, double mu, double sigma)
+{
+    uint64_t block = rng_next_block(state);
+
+    double u = block_to_signed(block);
 
-    for (size_t i = 0; i < d; ++i)
-        c[i] = fma(scratch[i], factor, c[i]);
+    size_t layer = block % TRANSFORM_LAYERS;
+
+    double x = (fabs(u) < layer_ratio[layer]) ?
+        u * layer_x[layer] :
+        ziggurat_slow(state, block);
+
+    return fma(x, sigma, mu);
+}
+
+/*
+   The fast path runs over a whole chunk of blocks without branching, and the
+   few draws which missed are finished afterwards.
+*/
+
+void transform_normal_array(
+        RNG_STATE_T state,
+        double mu,
+        double sigma,
+        double *out,
+        size_t n
+        )
+{
+    uint64_t blocks[TRANSFORM_CHUNK];
+
+    for (size_t i = 0; i < n; i += TRANSFORM_CHUNK)
+    {
+        size_t len = (n - i < TRANSFORM_CHUNK) ? n - i : TRANSFORM_CHUNK;
+
+        rng_fill_blocks(state, blocks, len);
+
+        size_t misses = 0;
+
+        for (size_t j = 0; j < len; ++j)
+        {
+            double u = block_to_signed(blocks[j]);
+
+            size_t layer = blocks[j] % TRANSFORM_LAYERS;
+
+            out[i + j] = u * layer_x[layer];
+
+            misses += !(fabs(u) < layer_ratio[layer]);
+        }
+
+        for (size_t j = 0; misses && j < len; ++j)
+        {
+            double u = block_to_signed(blocks[j]);
+
+            if (fabs(u) < layer_ratio[blocks[j] % TRANSFORM_LAYERS])
+                continue;
+
+            out[i + j] = ziggurat_slow(state, blocks[j]);
+
+            --misses;
+        }
+
+        for (size_t j = 0; j < len; ++j)
+            out[i + j] = fma(out[i + j], sigma, mu);
+    }
+}
+
+void transform_hypersphere(RNG_STATE_T state, double r, double *c, size_t d)
+{
+    transform_hypersphere_inline(state, r, c, d);
 }
@@ -4,9 +4,11 @@
 /*
    This is the interface for the supplied functions which transform a random
    bitstream into values from various distributions. Each function takes an RNG
-   state as an input, possibly followed by distribution parameters.
+   state as an input, possibly followed by distribution parameters. None of them
+   lock anything, so a state must never be shared between threads.
 */
 
+#include <math.h>
 #include <stdlib.h>
 
 #include "rng.h"
@@ -24,14 +26,21 @@
 #define TRANSFORM_MAX_TRIES 128
 #endif
 
+// Functions marked with TRANSFORM_INLINE are always inlined.
+#ifdef __GNUC__
+#define TRANSFORM_INLINE static inline __attribute__((always_inline))
+#else
+#define TRANSFORM_INLINE static inline
+#endif
+
 /*
-   This constant gives the maximum number of dimensions for hypherspherical
-   sampling. It saves us from having to dynamically allocate memory. This also
-   places a bound on the maxiumum dimensionality of PSO.
+   This constant defines the number of blocks the array functions below draw
+   from the RNG at once with *rng_fill_blocks()*. The blocks are kept on the
+   stack.
 */
 
-#ifndef TRANSFORM_MAX_DIM
-#define TRANSFORM_MAX_DIM 50
+#ifndef TRANSFORM_CHUNK
+#define TRANSFORM_CHUNK 64
 #endif
 
 /*
@@ -43,6 +52,22 @@
 
 uint64_t transform_integer(RNG_STATE_T state, uint64_t l, uint64_t u);
 
+/*
+   This function writes *n* integers uniformly drawn from [*l*, *u*] to *out*.
+   When the interval has fewer than 2^32 values, each one is taken from half a
+   block by multiplication (Lemire, "Fast random integer generation in an
+   interval", 2019), with the blocks drawn in bulk. Otherwise it falls back to
+   *transform_integer()*.
+*/
+
+void transform_integer_array(
+        RNG_STATE_T state,
+        uint64_t l,
+        uint64_t u,
+        uint64_t *out,
+        size_t n
+        );
+
 /*
    This function returns a floating point value which comes from a "good
    enough" approximately uniform distribution on [*l*, *u*). Since the
@@ -52,20 +77,83 @@ uint64_t transform_integer(RNG_STATE_T state, uint64_t l, uint64_t u);
 
 double transform_real(RNG_STATE_T state, double l, double u);
 
+/*
+   This function writes *n* values drawn as by *transform_real()* to *out*. The
+   values are exactly those that *n* calls to *transform_real()* would return,
+   but the blocks are drawn in bulk.
+*/
+
+void transform_real_array(
+        RNG_STATE_T state,
+        double l,
+        double u,
+        double *out,
+        size_t n
+        );
+
 /*
    This function returns a number drawn from a normal distribution with mean
-   *mu* and standard deviation *sigma*.
+   *mu* and standard deviation *sigma*. It uses the Ziggurat method, which
+   usually needs a single block and no calls to libm.
 */
 
 double transform_normal(RNG_STATE_T state, double mu, double sigma);
 
+/*
+   This function writes *n* numbers drawn from a normal distribution with mean
+   *mu* and standard deviation *sigma* to *out*. It draws the blocks in bulk and
+   takes the fast path of the Ziggurat method for all of them at once.
+*/
+
+void transform_normal_array(
+        RNG_STATE_T state,
+        double mu,
+        double sigma,
+        double *out,
+        size_t n
+        );
+
 /*
    This function uniformly generates a position vector whose distance from *c*
-   is less than or equal to *r*. The number of dimensions is given by *d*,
-   which is clipped if it exceeds TRANSFORM_MAX_DIM. The result is written over
-   *c*.
+   is less than or equal to *r*. The number of dimensions is given by *d*, and
+   the result is written over *c*. It needs *d* + 2 doubles of stack space.
 */
 
 void transform_hypersphere(RNG_STATE_T state, double r, double *c, size_t d);
 
+/*
+   This is the body of *transform_hypersphere()*, for inlining into kernels
+   built for a fixed *d*. The first d coordinates of a point drawn uniformly
+   from the surface of the unit (d + 1)-sphere are uniformly distributed in the
+   unit d-ball (Voelker et al., "Efficiently sampling vectors and coordinates
+   from the n-sphere and n-ball", 2017). So d + 2 normals scaled to unit length
+   give the offset directly, and the radius needs no pow(u, 1 / d).
+*/
+
+TRANSFORM_INLINE void transform_hypersphere_inline(
+        RNG_STATE_T state,
+        double r,
+        double *c,
+        size_t d
+        )
+{
+    double scratch[d + 2];
+
+    double norm = 0;
+
+    transform_normal_array(state, 0, 1, scratch, d + 2);
+
+    for (size_t i = 0; i < d + 2; ++i)
+        norm += scratch[i] * scratch[i];
+
+    // This only happens if the RNG is broken.
+    if (!(norm > 0))
+        return;
+
+    double factor = r / sqrt(norm);
+
+    for (size_t i = 0; i < d; ++i)
+        c[i] = fma(scratch[i], factor, c[i]);
+}
+
 #endif
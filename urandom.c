@@ -1,7 +1,9 @@
 #define _GNU_SOURCE
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <linux/random.h>
 #include <sys/syscall.h>
@@ -28,7 +30,15 @@ char *rng_uid(void)
 
 RNG_STATE_T rng_allocate_state(void)
 {
-    return malloc(sizeof(URANDOM_STATE_T));
+    // The size is rounded up to whole cache lines.
+    size_t len = sizeof(URANDOM_STATE_T) + RNG_ALIGNMENT - 1;
+
+    void *state;
+
+    if (posix_memalign(&state, RNG_ALIGNMENT, len - len % RNG_ALIGNMENT) != 0)
+        return NULL;
+
+    return state;
 }
 
 void rng_free_state(RNG_STATE_T state)
@@ -38,12 +48,45 @@ void rng_free_state(RNG_STATE_T state)
 
 void rng_initialize_state(RNG_STATE_T state, RNG_SEED_T seed)
 {
+    (void)seed;
+
     ((URANDOM_STATE_T *)state)->ctr = 32;
 }
 
+void rng_copy_state(RNG_STATE_T dst, RNG_STATE_T src)
+{
+    (void)src;
+
+    rng_initialize_state(dst, NULL);
+}
+
+void rng_jump(RNG_STATE_T state)
+{
+    (void)state;
+}
+
+size_t rng_state_size(void)
+{
+    return 0;
+}
+
+void rng_save_state(RNG_STATE_T state, void *buf)
+{
+    (void)state;
+    (void)buf;
+}
+
+void rng_load_state(RNG_STATE_T state, const void *buf)
+{
+    (void)buf;
+
+    rng_initialize_state(state, NULL);
+}
+
 void rng_derive_seed(RNG_SEED_T seed, char *phrase)
 {
-    // Do nothing.
+    (void)seed;
+    (void)phrase;
 }
 
 uint64_t rng_next_block(RNG_STATE_T state)
@@ -59,3 +102,37 @@ uint64_t rng_next_block(RNG_STATE_T state)
 
     return s->buf[s->ctr++];
 }
+
+// Whatever is left in the buffer is used up first.
+void rng_fill_blocks(RNG_STATE_T state, uint64_t *buf, size_t n)
+{
+    URANDOM_STATE_T *s = (URANDOM_STATE_T *)state;
+
+    size_t len = 32 - s->ctr;
+
+    if (len > n)
+        len = n;
+
+    memcpy(buf, s->buf + s->ctr, len * sizeof(uint64_t));
+
+    s->ctr += len;
+
+    char *cursor = (char *)(buf + len);
+
+    size_t remaining = (n - len) * sizeof(uint64_t);
+
+    // Requests of more than 256 bytes may be cut short by signals.
+    while (remaining)
+    {
+        long got = syscall(SYS_getrandom, cursor, remaining, 0);
+
+        if (got < 0 && errno == EINTR)
+            continue;
+
+        if (got <= 0)
+            break;
+
+        cursor += got;
+        remaining -= got;
+    }
+}
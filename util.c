@@ -3,11 +3,62 @@
 
 #include "util.h"
 
+/*
+   Each block drawn in bulk gives two 32-bit values, which are mapped to [0, i]
+   with Lemire's multiply-and-shift method. Only the rare products falling in
+   the biased low range need a division to be detected and rejected.
+*/
+
 void util_list_shuffle(RNG_STATE_T state, uint64_t *list, size_t len)
 {
+    uint64_t blocks[TRANSFORM_CHUNK];
+
+    size_t pos = 0;
+    size_t avail = 0;
+
     for (size_t i = len - 1; i > 0; --i)
     {
-        uint64_t j = transform_integer(state, 0, i);
+        uint64_t j;
+
+        if (i >= UINT32_MAX)
+            j = transform_integer(state, 0, i);
+        else
+        {
+            uint32_t range = i + 1;
+
+            for (unsigned tries = 0; ; ++tries)
+            {
+                if (pos == avail)
+                {
+                    size_t n = i / 2 + 1;
+
+                    if (n > TRANSFORM_CHUNK)
+                        n = TRANSFORM_CHUNK;
+
+                    rng_fill_blocks(state, blocks, n);
+
+                    pos = 0;
+                    avail = 2 * n;
+                }
+
+                uint32_t half = blocks[pos / 2] >> (32 * (pos % 2));
+
+                ++pos;
+
+                j = (uint64_t)half * range;
+
+                uint32_t low = j;
+
+                if (
+                        low >= range ||
+                        low >= (uint32_t)-range % range ||
+                        tries == TRANSFORM_MAX_TRIES
+                   )
+                    break;
+            }
+
+            j >>= 32;
+        }
 
         uint64_t t = list[i];
         list[i] = list[j];
@@ -21,18 +72,22 @@ void util_list_map(double *in, double *out, double *m, double *b, size_t d)
         out[i] = fma(in[i], m[i], b[i]);
 }
 
-double util_list_dist(double *v, double *w, size_t d)
+void util_array_map(
+        double *in,
+        double *out,
+        double *m,
+        double *b,
+        size_t n,
+        size_t d
+        )
 {
-    double dist = 0;
-
-    for (size_t i = 0; i < d; ++i)
-    {
-        double diff = v[i] - w[i];
-
-        dist += diff * diff;
-    }
+    for (size_t i = 0; i < n; ++i)
+        util_list_map(in + i * d, out + i * d, m, b, d);
+}
 
-    return sqrt(dist);
+UTIL_CLONES double util_list_dist(double *v, double *w, size_t d)
+{
+    return util_list_dist_inline(v, w, d);
 }
 
 bool util_array_lhs(RNG_STATE_T state, double *coords, uint64_t n, size_t d)
@@ -74,13 +129,15 @@ bool util_array_lhs(RNG_STATE_T state, double *coords, uint64_t n, size_t d)
        randomly placed within its grid cube.
     */
 
+    transform_real_array(state, 0, eps, coords, num_entries);
+
     for (size_t i = 0; i < n; ++i)
     {
         for (size_t j = 0; j < d; ++j)
             coords[i * d + j] = fma(
                     array[j * n + i],
                     eps,
-                    transform_real(state, 0, eps)
+                    coords[i * d + j]
                     );
     }
 
@@ -3,10 +3,55 @@
 
 // This file provides definitions for various PSO utility functions.
 
+#include <math.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "transform.h"
 
+/*
+   The list functions that matter in the PSO update loop process UTIL_LANES
+   doubles at a time. Unless EXCLUDE_SIMD is defined, GCC-compatible compilers
+   build them with generic vector types, and on x86-64 they are additionally
+   cloned for AVX-512 and AVX2 with the best clone being picked at load time
+   (function multiversioning). The lanes are always combined in the same order,
+   so every clone, as well as the scalar fallback, gives bit-identical results.
+*/
+
+#define UTIL_LANES 8
+
+#if defined(__GNUC__) && !defined(EXCLUDE_SIMD)
+#define UTIL_VECTORS
+
+typedef double UTIL_VECTOR_T
+    __attribute__((vector_size(UTIL_LANES * sizeof(double))));
+
+typedef int64_t UTIL_MASK_T
+    __attribute__((vector_size(UTIL_LANES * sizeof(int64_t))));
+#endif
+
+#if defined(UTIL_VECTORS) && defined(__x86_64__)
+#define UTIL_CLONES __attribute__((target_clones( \
+                "arch=skylake-avx512", \
+                "arch=haswell", \
+                "default" \
+                )))
+#else
+#define UTIL_CLONES
+#endif
+
+/*
+   Functions marked with UTIL_INLINE are always inlined, so that kernels built
+   for a fixed length (and cloned for a wider instruction set) get copies
+   specialized for them.
+*/
+
+#ifdef __GNUC__
+#define UTIL_INLINE static inline __attribute__((always_inline))
+#else
+#define UTIL_INLINE static inline
+#endif
+
 // This function randomly permutes a list of integers.
 
 void util_list_shuffle(RNG_STATE_T state, uint64_t *list, size_t len);
@@ -19,13 +64,73 @@ void util_list_shuffle(RNG_STATE_T state, uint64_t *list, size_t len);
 
 void util_list_map(double *in, double *out, double *m, double *b, size_t d);
 
+/*
+   This function applies the same transform as *util_list_map()* to each of the
+   *n* consecutive *d*-vectors in *in*.
+*/
+
+void util_array_map(
+        double *in,
+        double *out,
+        double *m,
+        double *b,
+        size_t n,
+        size_t d
+        );
+
 /*
    This function returns the Euclidean distance between the *d*-vectors *v* and
-   *w*.
+   *w*. Whole blocks of UTIL_LANES coordinates are accumulated lane by lane
+   before the remainder is added.
 */
 
 double util_list_dist(double *v, double *w, size_t d);
 
+// This is the body of *util_list_dist()*, for inlining into kernels.
+UTIL_INLINE double util_list_dist_inline(double *v, double *w, size_t d)
+{
+    double dist = 0;
+
+    size_t i = 0;
+
+#ifdef UTIL_VECTORS
+    UTIL_VECTOR_T acc = { 0 };
+
+    for (; i + UTIL_LANES <= d; i += UTIL_LANES)
+    {
+        UTIL_VECTOR_T a, b;
+
+        memcpy(&a, v + i, sizeof(a));
+        memcpy(&b, w + i, sizeof(b));
+
+        a -= b;
+        acc += a * a;
+    }
+#else
+    double acc[UTIL_LANES] = { 0 };
+
+    for (; i + UTIL_LANES <= d; i += UTIL_LANES)
+        for (size_t j = 0; j < UTIL_LANES; ++j)
+        {
+            double diff = v[i + j] - w[i + j];
+
+            acc[j] += diff * diff;
+        }
+#endif
+
+    for (size_t j = 0; j < UTIL_LANES; ++j)
+        dist += acc[j];
+
+    for (; i < d; ++i)
+    {
+        double diff = v[i] - w[i];
+
+        dist += diff * diff;
+    }
+
+    return sqrt(dist);
+}
+
 /*
    This function writes out coordinates in the hypercube [0, 1]^*d* according
    to Latin Hypercube Sampling. The space is divided into a grid of cubes with
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200112L
+
 // This file gives an implementation of the xorshift128+ generator.
 
 #include <stdlib.h>
@@ -17,7 +19,12 @@ char *rng_uid(void)
 
 RNG_STATE_T rng_allocate_state(void)
 {
-    return malloc(16);
+    void *state;
+
+    if (posix_memalign(&state, RNG_ALIGNMENT, RNG_ALIGNMENT) != 0)
+        return NULL;
+
+    return state;
 }
 
 void rng_free_state(RNG_STATE_T state)
@@ -44,6 +51,58 @@ void rng_initialize_state(RNG_STATE_T state, RNG_SEED_T seed)
         rng_next_block(state);
 }
 
+void rng_copy_state(RNG_STATE_T dst, RNG_STATE_T src)
+{
+    memcpy(dst, src, 16);
+}
+
+size_t rng_state_size(void)
+{
+    return 16;
+}
+
+void rng_save_state(RNG_STATE_T state, void *buf)
+{
+    memcpy(buf, state, 16);
+}
+
+void rng_load_state(RNG_STATE_T state, const void *buf)
+{
+    memcpy(state, buf, 16);
+}
+
+/*
+   The jump polynomial is x^(2^64) modulo the characteristic polynomial of the
+   generator's linear transformation, with bit i holding the coefficient of
+   x^i. Summing (over GF(2)) the states at the positions of its set bits gives
+   the state 2^64 steps ahead.
+*/
+
+void rng_jump(RNG_STATE_T state)
+{
+    static const uint64_t jump[] = { 0x8a5cd789635d2dff, 0x121fd2155c472f96 };
+
+    uint64_t *s = (uint64_t *)state;
+
+    uint64_t s0 = 0;
+    uint64_t s1 = 0;
+
+    for (unsigned i = 0; i < 2; ++i)
+        for (unsigned b = 0; b < 64; ++b)
+        {
+            if (jump[i] & (uint64_t)1 << b)
+            {
+                s0 ^= s[0];
+                s1 ^= s[1];
+            }
+
+            rng_next_block(state);
+        }
+
+    s[0] = s0;
+    s[1] = s1;
+}
+
 /* 128-bit multiplication emulated with 4 64-bit values, each representing a
    32-bit value plus carry. The high 128 bits of the product are ignored.
 */
@@ -111,10 +170,8 @@ void rng_derive_seed(RNG_SEED_T seed, char *phrase)
     s[1] = hash[3] << 32 | hash[2];
 }
 
-uint64_t rng_next_block(RNG_STATE_T state)
+static inline uint64_t next(uint64_t *s)
 {
-    uint64_t *s = (uint64_t *)state;
-
     uint64_t x = s[0];
     uint64_t y = s[1];
 
@@ -124,3 +181,21 @@ uint64_t rng_next_block(RNG_STATE_T state)
 
     return (s[1] = x ^ y ^ (x >> 18) ^ (y >> 5)) + y;
 }
+
+uint64_t rng_next_block(RNG_STATE_T state)
+{
+    return next((uint64_t *)state);
+}
+
+// The state is kept in registers for the whole loop.
+void rng_fill_blocks(RNG_STATE_T state, uint64_t *buf, size_t n)
+{
+    uint64_t s[2];
+
+    memcpy(s, state, 16);
+
+    for (size_t i = 0; i < n; ++i)
+        buf[i] = next(s);
+
+    memcpy(state, s, 16);
+}